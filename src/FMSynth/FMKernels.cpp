@@ -0,0 +1,507 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: FMKernels.cpp
+
+Vector render kernels of FMSynth, see FMKernels.hpp.
+*/
+
+#include "FMKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "algorithms.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define FM_KERNEL_AVX2 1
+#define FM_KERNEL_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FM_KERNEL_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FM_KERNEL_NEON 1
+#endif
+
+namespace {
+
+constexpr float kTwoPi = 2 * 3.14159265f;
+constexpr float kInvPi = 0.318309886f;
+// pi split in two so k * kPiHi is exact for the k of a block's phases.
+constexpr float kPiHi = 3.140625f;
+constexpr float kPiLo = 9.67653589793e-4f;
+// Odd minimax polynomial of sin(y) on [-pi/2, pi/2].
+constexpr float kSin3 = -1.6666654611e-1f;
+constexpr float kSin5 = 8.3330251389e-3f;
+constexpr float kSin7 = -1.9807418727e-4f;
+constexpr float kSin9 = 2.6019030676e-6f;
+
+/*
+  Four and eight float lanes. Each type has splat, load, store, the
+  arithmetic the kernel uses, half_turns(x): x - k pi for the nearest
+  integer k, negated when k is odd, so sin(x) = sin(half_turns(x)), and
+  interpolate(table, t): table[t] linearly interpolated, for t >= 0.
+*/
+#if defined(FM_KERNEL_SSE2)
+struct F4 {
+  static constexpr int lanes = 4;
+  __m128 v;
+  static F4 splat(float x) { return {_mm_set1_ps(x)}; }
+  static F4 load(const float *p) { return {_mm_loadu_ps(p)}; }
+  void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+inline F4 operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F4 operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F4 operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F4 half_turns(F4 x) {
+  const __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x.v, _mm_set1_ps(kInvPi)));
+  const __m128 kf = _mm_cvtepi32_ps(k);
+  __m128 y = _mm_sub_ps(x.v, _mm_mul_ps(kf, _mm_set1_ps(kPiHi)));
+  y = _mm_sub_ps(y, _mm_mul_ps(kf, _mm_set1_ps(kPiLo)));
+  return {_mm_xor_ps(y, _mm_castsi128_ps(_mm_slli_epi32(k, 31)))};
+}
+inline F4 interpolate(const float *table, F4 t) {
+  const __m128i i = _mm_cvttps_epi32(t.v);
+  const __m128 frac = _mm_sub_ps(t.v, _mm_cvtepi32_ps(i));
+  alignas(16) int index[4];
+  _mm_store_si128((__m128i *)index, i);
+  const __m128 y0 = _mm_setr_ps(table[index[0]], table[index[1]],
+                                table[index[2]], table[index[3]]);
+  const __m128 y1 = _mm_setr_ps(table[index[0] + 1], table[index[1] + 1],
+                                table[index[2] + 1], table[index[3] + 1]);
+  return {_mm_add_ps(y0, _mm_mul_ps(frac, _mm_sub_ps(y1, y0)))};
+}
+#elif defined(FM_KERNEL_NEON)
+struct F4 {
+  static constexpr int lanes = 4;
+  float32x4_t v;
+  static F4 splat(float x) { return {vdupq_n_f32(x)}; }
+  static F4 load(const float *p) { return {vld1q_f32(p)}; }
+  void store(float *p) const { vst1q_f32(p, v); }
+};
+inline F4 operator+(F4 a, F4 b) { return {vaddq_f32(a.v, b.v)}; }
+inline F4 operator-(F4 a, F4 b) { return {vsubq_f32(a.v, b.v)}; }
+inline F4 operator*(F4 a, F4 b) { return {vmulq_f32(a.v, b.v)}; }
+inline F4 half_turns(F4 x) {
+  const int32x4_t k = vcvtnq_s32_f32(vmulq_f32(x.v, vdupq_n_f32(kInvPi)));
+  const float32x4_t kf = vcvtq_f32_s32(k);
+  float32x4_t y = vsubq_f32(x.v, vmulq_f32(kf, vdupq_n_f32(kPiHi)));
+  y = vsubq_f32(y, vmulq_f32(kf, vdupq_n_f32(kPiLo)));
+  const uint32x4_t sign = vshlq_n_u32(vreinterpretq_u32_s32(k), 31);
+  return {vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(y), sign))};
+}
+inline F4 interpolate(const float *table, F4 t) {
+  const int32x4_t i = vcvtq_s32_f32(t.v);
+  const float32x4_t frac = vsubq_f32(t.v, vcvtq_f32_s32(i));
+  int index[4];
+  vst1q_s32(index, i);
+  float y0[4], y1[4];
+  for (int l = 0; l < 4; l++) {
+    y0[l] = table[index[l]];
+    y1[l] = table[index[l] + 1];
+  }
+  const float32x4_t v0 = vld1q_f32(y0);
+  return {vaddq_f32(v0, vmulq_f32(frac, vsubq_f32(vld1q_f32(y1), v0)))};
+}
+#else
+struct F4 {
+  static constexpr int lanes = 4;
+  float v[4];
+  static F4 splat(float x) { return {{x, x, x, x}}; }
+  static F4 load(const float *p) { return {{p[0], p[1], p[2], p[3]}}; }
+  void store(float *p) const { std::copy_n(v, 4, p); }
+};
+inline F4 operator+(F4 a, F4 b) {
+  for (int l = 0; l < 4; l++) a.v[l] += b.v[l];
+  return a;
+}
+inline F4 operator-(F4 a, F4 b) {
+  for (int l = 0; l < 4; l++) a.v[l] -= b.v[l];
+  return a;
+}
+inline F4 operator*(F4 a, F4 b) {
+  for (int l = 0; l < 4; l++) a.v[l] *= b.v[l];
+  return a;
+}
+inline F4 half_turns(F4 x) {
+  for (int l = 0; l < 4; l++) {
+    const float k = std::nearbyint(x.v[l] * kInvPi);
+    const float y = (x.v[l] - k * kPiHi) - k * kPiLo;
+    x.v[l] = ((long)k & 1) ? -y : y;
+  }
+  return x;
+}
+inline F4 interpolate(const float *table, F4 t) {
+  for (int l = 0; l < 4; l++) {
+    const int i = (int)t.v[l];
+    const float frac = t.v[l] - (float)i;
+    t.v[l] = table[i] + frac * (table[i + 1] - table[i]);
+  }
+  return t;
+}
+#endif
+
+#if defined(FM_KERNEL_AVX2)
+struct F8 {
+  static constexpr int lanes = 8;
+  __m256 v;
+  static F8 splat(float x) { return {_mm256_set1_ps(x)}; }
+  static F8 load(const float *p) { return {_mm256_loadu_ps(p)}; }
+  void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+inline F8 operator+(F8 a, F8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline F8 operator-(F8 a, F8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline F8 operator*(F8 a, F8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline F8 half_turns(F8 x) {
+  const __m256i k =
+      _mm256_cvtps_epi32(_mm256_mul_ps(x.v, _mm256_set1_ps(kInvPi)));
+  const __m256 kf = _mm256_cvtepi32_ps(k);
+  __m256 y = _mm256_sub_ps(x.v, _mm256_mul_ps(kf, _mm256_set1_ps(kPiHi)));
+  y = _mm256_sub_ps(y, _mm256_mul_ps(kf, _mm256_set1_ps(kPiLo)));
+  return {_mm256_xor_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(k, 31)))};
+}
+inline F8 interpolate(const float *table, F8 t) {
+  const __m256i i = _mm256_cvttps_epi32(t.v);
+  const __m256 frac = _mm256_sub_ps(t.v, _mm256_cvtepi32_ps(i));
+  const __m256 y0 = _mm256_i32gather_ps(table, i, 4);
+  const __m256 y1 = _mm256_i32gather_ps(table + 1, i, 4);
+  return {_mm256_add_ps(y0, _mm256_mul_ps(frac, _mm256_sub_ps(y1, y0)))};
+}
+#else
+// Two four-lane halves.
+struct F8 {
+  static constexpr int lanes = 8;
+  F4 lo, hi;
+  static F8 splat(float x) { return {F4::splat(x), F4::splat(x)}; }
+  static F8 load(const float *p) { return {F4::load(p), F4::load(p + 4)}; }
+  void store(float *p) const {
+    lo.store(p);
+    hi.store(p + 4);
+  }
+};
+inline F8 operator+(F8 a, F8 b) { return {a.lo + b.lo, a.hi + b.hi}; }
+inline F8 operator-(F8 a, F8 b) { return {a.lo - b.lo, a.hi - b.hi}; }
+inline F8 operator*(F8 a, F8 b) { return {a.lo * b.lo, a.hi * b.hi}; }
+inline F8 half_turns(F8 x) { return {half_turns(x.lo), half_turns(x.hi)}; }
+inline F8 interpolate(const float *table, F8 t) {
+  return {interpolate(table, t.lo), interpolate(table, t.hi)};
+}
+#endif
+
+template <class V>
+inline V polynomial_sin(V x) {
+  const V y = half_turns(x);
+  const V y2 = y * y;
+  V p = V::splat(kSin9);
+  p = p * y2 + V::splat(kSin7);
+  p = p * y2 + V::splat(kSin5);
+  p = p * y2 + V::splat(kSin3);
+  return y + y * y2 * p;
+}
+
+// sin over [-pi/2, pi/2], one guard point for the interpolation.
+struct SineTable {
+  static constexpr int kSize = 1024;
+  static constexpr double kPi = 3.14159265358979323846;
+  float values[kSize + 2];
+  SineTable() {
+    for (int i = 0; i <= kSize + 1; i++)
+      values[i] = (float)std::sin(kPi * ((double)i / kSize - 0.5));
+  }
+};
+const SineTable kSineTable;
+
+/*
+  Sine engines, see FMKernels.hpp. rotates is true for engines that replace
+  the sine of unmodulated operators with a rotating phasor.
+*/
+struct ExactSine {
+  static constexpr bool rotates = false;
+  template <class V>
+  static V sin(V x) {
+    alignas(64) float lanes[V::lanes];
+    x.store(lanes);
+    for (int l = 0; l < V::lanes; l++) lanes[l] = std::sin(lanes[l]);
+    return V::load(lanes);
+  }
+};
+
+struct PolynomialSine {
+  static constexpr bool rotates = false;
+  template <class V>
+  static V sin(V x) {
+    return polynomial_sin(x);
+  }
+};
+
+struct TableSine {
+  static constexpr bool rotates = false;
+  template <class V>
+  static V sin(V x) {
+    // half_turns is within [-pi/2, pi/2] up to rounding, the guard point
+    // covers t == kSize.
+    const V t = (half_turns(x) + V::splat(kPiHi / 2 + kPiLo / 2)) *
+                V::splat(SineTable::kSize * kInvPi);
+    return interpolate(kSineTable.values, t);
+  }
+};
+
+struct PhasorSine {
+  static constexpr bool rotates = true;
+  template <class V>
+  static V sin(V x) {
+    return polynomial_sin(x);
+  }
+};
+
+// Phasors are pulled back to unit length every kRenormalise iterations.
+constexpr int kRenormalise = 32;
+
+inline float wrap_phase(float phase) {
+  return phase - kTwoPi * std::floor(phase / kTwoPi);
+}
+
+/*
+  Operator graph of an algorithm, in the order render_mm scans the
+  modulation matrix: modulators from OP6 down, each with its carriers from
+  OP1 up. Built at compile time from the tables in algorithms.hpp.
+*/
+struct FMTopology {
+  int n_modulators = 0;
+  int modulators[6] = {};
+  int n_carriers[6] = {};
+  int carriers[6][6] = {};
+  int n_outputs = 0;
+  int outputs[6] = {};  // Operators with an output level
+  bool modulated[6] = {};
+};
+
+constexpr FMTopology make_topology(const int *modmatrix,
+                                   const float *outmatrix) {
+  FMTopology topology;
+  for (int mod_op = 5; mod_op >= 0; mod_op--) {
+    for (int carr_op = 0; carr_op < 6; carr_op++) {
+      if (!modmatrix[carr_op * 6 + mod_op]) continue;
+      topology.carriers[mod_op][topology.n_carriers[mod_op]++] = carr_op;
+      topology.modulated[carr_op] = true;
+    }
+    if (topology.n_carriers[mod_op] > 0)
+      topology.modulators[topology.n_modulators++] = mod_op;
+  }
+  for (int i = 0; i < 6; i++)
+    if (outmatrix[i] != 0.0f) topology.outputs[topology.n_outputs++] = i;
+  return topology;
+}
+
+template <int Alg>
+struct Algorithm {
+  static constexpr FMTopology topology =
+      make_topology(ALG_MM_TABLE[Alg], ALG_OUTM_TABLE[Alg]);
+};
+
+// Calls f(std::integral_constant<int, i>) for i in [0, N), unrolled.
+template <class F, int... I>
+inline void static_for(F &&f, std::integer_sequence<int, I...>) {
+  (f(std::integral_constant<int, I>()), ...);
+}
+
+template <int N, class F>
+inline void static_for(F &&f) {
+  static_for(f, std::make_integer_sequence<int, N>());
+}
+
+template <int W, class Sine, int Alg>
+void render_block(const float *outmatrix, unsigned live, FMRenderState &state,
+                  float *out, int n_samples) {
+  using V = typename std::conditional<W == 4, F4, F8>::type;
+  constexpr int kVectors = W / V::lanes;
+  using Graph = Algorithm<Alg>;
+
+  alignas(64) float ramp[W];
+  for (int s = 0; s < W; s++) ramp[s] = (float)s;
+  const V scale = V::splat(kTwoPi);
+
+  // Operators pruned for this block keep their phase but skip their sine,
+  // the same for every sample, so the branch is always predicted.
+  auto is_live = [live](int op) { return (live >> op) & 1u; };
+
+  // The phase of an unmodulated operator is linear, so its sine can be
+  // rotated from one iteration to the next. The phasors are seeded from the
+  // phase at the start of every block.
+  constexpr auto rotates = [](int op) {
+    return Sine::rotates && !Graph::topology.modulated[op];
+  };
+  V rot_sin[6][kVectors] = {}, rot_cos[6][kVectors] = {};
+  float step_sin[6] = {}, step_cos[6] = {};
+  static_for<6>([&](auto op) {
+    if constexpr (rotates(op)) {
+      if (!is_live(op)) return;
+      // Lane s starts at phase + s * inc, the lanes and the step of W
+      // samples are powers of the per sample rotation.
+      const float inc_sin = std::sin(state.phase_inc[op]);
+      const float inc_cos = std::cos(state.phase_inc[op]);
+      alignas(64) float seed_sin[W], seed_cos[W];
+      seed_sin[0] = std::sin(state.phase[op]);
+      seed_cos[0] = std::cos(state.phase[op]);
+      for (int s = 1; s < W; s++) {
+        seed_sin[s] = seed_sin[s - 1] * inc_cos + seed_cos[s - 1] * inc_sin;
+        seed_cos[s] = seed_cos[s - 1] * inc_cos - seed_sin[s - 1] * inc_sin;
+      }
+      for (int v = 0; v < kVectors; v++) {
+        rot_sin[op][v] = V::load(seed_sin + v * V::lanes);
+        rot_cos[op][v] = V::load(seed_cos + v * V::lanes);
+      }
+      float power_sin = inc_sin, power_cos = inc_cos;
+      for (int k = 1; k < W; k *= 2) {
+        const float next_sin = 2.0f * power_sin * power_cos;
+        power_cos = power_cos * power_cos - power_sin * power_sin;
+        power_sin = next_sin;
+      }
+      step_sin[op] = power_sin;
+      step_cos[op] = power_cos;
+    }
+  });
+
+  // The phases restart from a wrapped value every W samples, so the sine
+  // arguments stay small. The levels are exact in closed form.
+  std::array<float, 6> phase = state.phase;
+  for (int s0 = 0, iteration = 1; s0 < n_samples; s0 += W, iteration++) {
+    alignas(64) float block[W];
+    for (int v = 0; v < kVectors; v++) {
+      const V n = V::load(ramp + v * V::lanes);
+      const V n_ol = n + V::splat((float)s0);
+      V modphases[6], ol[6];
+      for (int i = 0; i < 6; i++) {
+        modphases[i] = V::splat(phase[i]) + n * V::splat(state.phase_inc[i]);
+        ol[i] = V::splat(state.ol[i]) + n_ol * V::splat(state.ol_inc[i]);
+      }
+      static_for<Graph::topology.n_modulators>([&](auto m) {
+        constexpr int mod_op = Graph::topology.modulators[m];
+        if (!is_live(mod_op)) return;
+        V mod_sin;
+        if constexpr (rotates(mod_op))
+          mod_sin = rot_sin[mod_op][v];
+        else
+          mod_sin = Sine::sin(modphases[mod_op]);
+        const V mod_output_to_carrier = mod_sin * ol[mod_op] * scale;
+        static_for<Graph::topology.n_carriers[mod_op]>([&](auto c) {
+          constexpr int carr_op = Graph::topology.carriers[mod_op][c];
+          modphases[carr_op] = modphases[carr_op] + mod_output_to_carrier;
+        });
+      });
+      V sample = V::splat(0.0f);
+      static_for<Graph::topology.n_outputs>([&](auto o) {
+        constexpr int op = Graph::topology.outputs[o];
+        if (!is_live(op)) return;
+        V carr_sin;
+        if constexpr (rotates(op))
+          carr_sin = rot_sin[op][v];
+        else
+          carr_sin = Sine::sin(modphases[op]);
+        sample = sample + V::splat(outmatrix[op]) * ol[op] * carr_sin;
+      });
+      sample.store(block + v * V::lanes);
+    }
+    const int n_out = std::min(W, n_samples - s0);
+    std::copy_n(block, n_out, out + s0);
+    for (int i = 0; i < 6; i++)
+      phase[i] = wrap_phase(phase[i] + (float)n_out * state.phase_inc[i]);
+
+    if (!Sine::rotates) continue;
+    const bool renormalise = (iteration * W) % kRenormalise == 0;
+    static_for<6>([&](auto op) {
+      if constexpr (rotates(op)) {
+        if (!is_live(op)) return;
+        const V c = V::splat(step_cos[op]), s = V::splat(step_sin[op]);
+        for (int v = 0; v < kVectors; v++) {
+          V rs = rot_sin[op][v] * c + rot_cos[op][v] * s;
+          V rc = rot_cos[op][v] * c - rot_sin[op][v] * s;
+          if (renormalise) {
+            // One Newton step towards 1 / |phasor|.
+            const V g =
+                V::splat(1.5f) - V::splat(0.5f) * (rs * rs + rc * rc);
+            rs = rs * g;
+            rc = rc * g;
+          }
+          rot_sin[op][v] = rs;
+          rot_cos[op][v] = rc;
+        }
+      }
+    });
+  }
+
+  state.phase = phase;
+  for (int i = 0; i < 6; i++)
+    state.ol[i] += (float)n_samples * state.ol_inc[i];
+}
+
+// Kernels of the 32 algorithms for one width and engine.
+template <int W, class Sine, int... Alg>
+constexpr std::array<FMBlockKernel, 32> algorithm_kernels(
+    std::integer_sequence<int, Alg...>) {
+  return {{&render_block<W, Sine, Alg>...}};
+}
+
+template <int W, class Sine>
+constexpr std::array<FMBlockKernel, 32> algorithm_kernels() {
+  return algorithm_kernels<W, Sine>(std::make_integer_sequence<int, 32>());
+}
+
+template <int W>
+constexpr std::array<std::array<FMBlockKernel, 32>, 4> engine_kernels() {
+  // In FMSineEngine order.
+  return {{algorithm_kernels<W, ExactSine>(),
+           algorithm_kernels<W, PolynomialSine>(),
+           algorithm_kernels<W, TableSine>(),
+           algorithm_kernels<W, PhasorSine>()}};
+}
+
+constexpr std::array<std::array<FMBlockKernel, 32>, 4> kKernels4 =
+    engine_kernels<4>();
+constexpr std::array<std::array<FMBlockKernel, 32>, 4> kKernels8 =
+    engine_kernels<8>();
+constexpr std::array<std::array<FMBlockKernel, 32>, 4> kKernels16 =
+    engine_kernels<16>();
+
+}  // namespace
+
+FMBlockKernel get_fm_block_kernel(int algorithm, int W, FMSineEngine engine) {
+  const auto &kernels =
+      (W == 4) ? kKernels4 : (W == 8) ? kKernels8 : kKernels16;
+  return kernels[(int)engine][algorithm];
+}
@@ -0,0 +1,108 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: FMKernels.hpp
+
+Vector render kernels of FMSynth.
+
+Within a block the pitch is constant and the output levels ramp linearly, so
+the phase and the level of every operator at sample n of the block are
+
+    phase_n = phase_0 + n * phase_inc
+    ol_n    = ol_0 + n * ol_inc
+
+The kernels generate them in closed form for W samples at once and run the
+algorithm on vectors of W samples. They follow the structure of the scalar
+loop in FMSynth::render_mm: modulators from OP6 down to OP1, each adding
+sin(phase) * ol * 2pi to its carriers, then the carriers summed through the
+output matrix. Every algorithm only has modulators above their carriers, so
+the sine of each operator is taken once per sample.
+
+There is one kernel per algorithm. The tables of algorithms.hpp are read at
+compile time into the list of modulators, carriers and outputs of the
+algorithm, and the kernel is unrolled over them: it has no matrix scan and
+no branch on the routing. FMSynth picks the kernel of its algorithm, width
+and engine with get_fm_block_kernel.
+
+The sine of the operators is computed by one of several engines, chosen per
+synth. Error bounds are the largest absolute error of the sine, measured by
+BesselsTrickFMBenchmark --engines:
+
+    EXACT       libm sinf on every lane                            3e-8
+    POLYNOMIAL  degree 9 minimax polynomial after reduction to
+                [-pi/2, pi/2]                                      1.5e-7
+    TABLE       1024 point table over [-pi/2, pi/2], linearly
+                interpolated, (pi / 1024)^2 / 8                    1.2e-6
+    PHASOR      unmodulated operators rotate a (cos, sin) phasor
+                W samples at a time, seeded from one sinf and cosf
+                per block and renormalised every 32 samples;
+                modulated operators use POLYNOMIAL                 1.4e-6
+
+EXACT calls sinf one lane at a time, so wider vectors do not help it. It
+costs about 4.5 times POLYNOMIAL with SSE2 and 8 to 10 times with AVX2,
+and is meant for offline renders. With SSE2 or AVX2, POLYNOMIAL and PHASOR
+are the fastest, within run-to-run noise of each other, and TABLE pays for
+its lookups. Without SIMD, PHASOR is the cheapest.
+
+Phases far from [-pi, pi] are reduced in two steps, so the bounds hold for
+the modulated phases of any patch.
+*/
+
+#ifndef SRC_FMSYNTH_FMKERNELS_HPP_
+#define SRC_FMSYNTH_FMKERNELS_HPP_
+
+#include <array>
+
+enum class FMSineEngine { EXACT, POLYNOMIAL, TABLE, PHASOR };
+
+struct FMRenderState {
+  std::array<float, 6> phase;      // First sample, in [0, 2pi)
+  std::array<float, 6> phase_inc;  // Per sample
+  std::array<float, 6> ol;         // First sample
+  std::array<float, 6> ol_inc;     // Per sample
+};
+
+// Renders n_samples of one algorithm into out, with the output levels of
+// outmatrix, and advances state past them. Only the operators set in the
+// live bit mask (bit i for OP(i + 1)) are rendered, the phases of all of
+// them advance. Phases are left wrapped to [0, 2pi).
+using FMBlockKernel = void (*)(const float *outmatrix, unsigned live,
+                               FMRenderState &state, float *out,
+                               int n_samples);
+
+// Kernel of algorithm (0 - 31) rendering W (4, 8 or 16) samples per
+// iteration with the given sine engine.
+FMBlockKernel get_fm_block_kernel(int algorithm, int W, FMSineEngine engine);
+
+#endif  // SRC_FMSYNTH_FMKERNELS_HPP_
@@ -42,6 +42,7 @@ File: FMSynth.cpp
 #include <iostream>
 #include <cstring>
 #include <algorithm>
+#include <numeric>
 #define OP6 5
 #define OP5 4
 #define OP4 3
@@ -51,6 +52,24 @@ File: FMSynth.cpp
 
 constexpr float TWO_PI = 2 * 3.14159265f;
 
+// Cycle cache (see render_cycle)
+constexpr int kRatioDenominator = 200;  // Ratios are multiples of 1/200
+constexpr int kCycleOversampling = 4;   // Least cycle points per output sample
+constexpr int kMaxCycle = 8192;         // Points, a power of two
+constexpr int kCycleChunk = 64;         // Points rendered from an exact phase
+
+inline float wrap_phase(float phase) {
+  return phase - TWO_PI * std::floor(phase / TWO_PI);
+}
+
+// Catmull-Rom interpolation between y[1] and y[2].
+inline float interpolate_cubic(const float* y, float t) {
+  const float c1 = 0.5f * (y[2] - y[0]);
+  const float c2 = y[0] - 2.5f * y[1] + 2.0f * y[2] - 0.5f * y[3];
+  const float c3 = 0.5f * (y[3] - y[0]) + 1.5f * (y[1] - y[2]);
+  return ((c3 * t + c2) * t + c1) * t + y[1];
+}
+
 FMSynth::FMSynth() {
   _config = 0;
   _t_step = 0;
@@ -62,34 +81,30 @@ FMSynth::~FMSynth() {
   //  free(_buffer); //No need. Vector deletes itself when out of scope.
 }
 
-void FMSynth::load_dx7_config(const std::array<uint8_t, 156> patch) {
-  std::cout << "FMSynth::load_dx7_config()" << std::endl;
-  uint8_t algorithm = patch[134];  // 0 - 31
-  set_config(algorithm);
+void FMSynth::read_dx7_config(const std::array<uint8_t, 156>& patch,
+                              unsigned int& config,
+                              std::array<uint8_t, 6>& fr_coarse,
+                              std::array<uint8_t, 6>& fr_fine) {
+  config = patch[134];  // 0 - 31
   for (int op = 0; op < 6; op++) {
     //  First in patch is OP6
     const int offset = op * 21;
-    uint8_t is_fixed = patch[offset + 17];
-    uint8_t f_coarse = patch[offset + 18];
-    uint8_t f_fine = patch[offset + 19];
-    uint8_t f_detune = patch[offset + 20];
-    _fr_coarse[5-op] = f_coarse;
-    _fr_fine[5-op] = f_fine;
-    
-    //  TODO: Add detune parameter +- 7 cents.
-    float f = (f_coarse == 0) ? 0.5f : (float)f_coarse;
-    _fr[5 - op] = f + (f / 100) * ((float)f_fine);
-    // std::cout << "coarse " << (int)f_coarse  << " fine " << (int)f_fine << "
-    // total: "<< _fr[5-op] << std::endl;
-  }
-  std::cout << "\t alg: " << (uint16_t)algorithm << " fr: " << _fr[0] << " "
-            << _fr[1] << " " << _fr[2] << " " << _fr[3] << " " << _fr[4] << " "
-            << _fr[5] << std::endl;
-  _config = algorithm;
+    fr_coarse[5 - op] = patch[offset + 18];
+    fr_fine[5 - op] = patch[offset + 19];
+    //  TODO: Add detune parameter +- 7 cents (patch[offset + 20]) and fixed
+    //  frequency operators (patch[offset + 17]).
+  }
   //  uint8_t transpose = (patch[144]-24);
   //  double factor = 2^(((double)transpose)/12.0);
   //  fr = factor*fr
-  return;
+}
+
+void FMSynth::load_dx7_config(const std::array<uint8_t, 156> patch) {
+  unsigned int config;
+  std::array<uint8_t, 6> fr_coarse, fr_fine;
+  read_dx7_config(patch, config, fr_coarse, fr_fine);
+  set_config(config);
+  set_ratios(fr_coarse, fr_fine);
 }
 
 void FMSynth::set_ratios(std::array<uint8_t, 6> fr_coarse, 
@@ -104,14 +119,15 @@ void FMSynth::set_ratios(std::array<uint8_t, 6> fr_coarse,
     float f = (fr_coarse[op] == 0) ? 0.5f : (float)fr_coarse[op];
     _fr[op] = f + (f / 100) * ((float)fr_fine[op]);
   }
+  drop_cycle();
 }
 
 void FMSynth::set_config(unsigned int config) {
   if (config > 31) {
     throw("FMSynth::set_config - Invalid config value.");
   }
-  memcpy(_outmatrix, _outm_table[config], sizeof(float) * 6);
-  memcpy(_modmatrix, _mm_table[config], sizeof(int) * 36);
+  memcpy(_outmatrix, ALG_OUTM_TABLE[config], sizeof(float) * 6);
+  memcpy(_modmatrix, ALG_MM_TABLE[config], sizeof(int) * 36);
 
   // Now, normalize outmatrix values.
   float outval = 0.0f;
@@ -121,10 +137,51 @@ void FMSynth::set_config(unsigned int config) {
 
   for (int i = 0; i < 6; i++) _outmatrix[i] /= outval;
   _config = config;  // Store value
+  select_block_kernel();
 }
 
 unsigned int FMSynth::get_config() { return _config; }
 
+void FMSynth::set_render_kernel(FMRenderKernel kernel) {
+  _render_kernel = kernel;
+  select_block_kernel();
+}
+
+FMRenderKernel FMSynth::get_render_kernel() { return _render_kernel; }
+
+void FMSynth::set_sine_engine(FMSineEngine engine) {
+  _sine_engine = engine;
+  select_block_kernel();
+}
+
+FMSineEngine FMSynth::get_sine_engine() { return _sine_engine; }
+
+void FMSynth::set_prune_level(float level) { _prune_level = level; }
+
+uint64_t FMSynth::get_pruned_samples() { return _pruned_samples; }
+
+bool FMSynth::is_silent() { return _previous_pitch_hz < 1.0f; }
+
+void FMSynth::set_cycle_tolerance(float tolerance) {
+  _cycle_tolerance = tolerance;
+  drop_cycle();
+}
+
+uint64_t FMSynth::get_cycle_samples() { return _cycle_samples; }
+
+void FMSynth::drop_cycle() {
+  _cycle_size = 0;
+  _cycle_fill_size = 0;
+}
+
+void FMSynth::select_block_kernel() {
+  int width = 8;
+  if (_render_kernel == FMRenderKernel::VECTOR4) width = 4;
+  if (_render_kernel == FMRenderKernel::VECTOR16) width = 16;
+  _block_kernel = get_fm_block_kernel(_config, width, _sine_engine);
+  drop_cycle();
+}
+
 std::array<uint8_t, 6> FMSynth::get_fr_coarse() { return _fr_coarse; }
 std::array<uint8_t, 6> FMSynth::get_fr_fine() { return _fr_fine; }
 
@@ -134,11 +191,15 @@ void FMSynth::init(float sampleRate, int blockSize) {
   _block_size = blockSize;
   _t_step = 1.0f / sampleRate;
   _previous_pitch_hz = 0.0f;
+  _pruned_samples = 0;
+  _cycle_samples = 0;
+  _cycle.assign(kMaxCycle + 3, 0.0f);
   reset_phase();
 }
 
 void FMSynth::reset_phase() {
   for (int i = 0; i < 6; i++) _phase[i] = 0.0f;
+  drop_cycle();
 }
 
 inline void FMSynth::fade_out() {
@@ -171,7 +232,7 @@ inline void FMSynth::update_phase(float pitch_hz) {
   }
 }
 
-float* FMSynth::render(float pitch_hz, std::vector<float> ol) {
+float* FMSynth::render(float pitch_hz, const std::vector<float>& ol) {
   /* Compute ol increment for linear interpolation */
   std::array<float, 6> inc_ol;
   for (int i = 0; i < _prev_ol.size(); i++)
@@ -211,6 +272,209 @@ float* FMSynth::render(float pitch_hz, std::vector<float> ol) {
 
 /* Render FM using modulation matrix */
 void FMSynth::render_mm(float pitch_hz, std::array<float, 6> inc_ol) {
+  if (_render_kernel == FMRenderKernel::SCALAR) {
+    render_mm_scalar(pitch_hz, inc_ol);
+    return;
+  }
+  if (_cycle_tolerance >= 0.0f && render_cycle(pitch_hz, inc_ol)) return;
+  FMRenderState state;
+  for (int i = 0; i < 6; i++)
+    state.phase_inc[i] = TWO_PI * pitch_hz * _fr[i] * _t_step;
+  state.phase = _phase;
+  state.ol = _prev_ol;
+  state.ol_inc = inc_ol;
+  const unsigned live = live_operators(inc_ol);
+  _block_kernel(_outmatrix, live, state, _buffer.data(), (int)_buffer.size());
+  _phase = state.phase;
+}
+
+/*
+  Operators worth rendering this block, as a bit mask.
+  An operator's sine reaches the output through its own output level and
+  through the phases of its carriers, 2pi * OL per radian at each stage,
+  so leaving it out moves the output by up to max OL * gain. Operators are
+  pruned, in order, while the sum of those bounds stays within
+  _prune_level: an OL near zero is enough for a carrier, a modulator
+  deep in a chain needs a much lower one. Carriers have lower indices
+  than their modulators, so one pass from OP1 up settles every carrier
+  first, and modulators that only feed pruned carriers have no gain left.
+*/
+unsigned FMSynth::live_operators(const std::array<float, 6>& inc_ol) {
+  unsigned live = 0;
+  float gain[6];  // Output change per radian of phase of each operator
+  float pruned_error = 0.0f;
+  for (int op = OP1; op <= OP6; op++) {
+    const float end_ol = _prev_ol[op] + inc_ol[op] * (float)_block_size;
+    const float max_ol = std::max(std::fabs(_prev_ol[op]), std::fabs(end_ol));
+    float op_gain = _outmatrix[op];
+    for (int carr_op = OP1; carr_op < op; carr_op++)
+      if (_modmatrix[carr_op * 6 + op] && (live >> carr_op & 1u))
+        op_gain += TWO_PI * gain[carr_op];
+    gain[op] = max_ol * op_gain;
+    if (pruned_error + gain[op] > _prune_level) {
+      live |= 1u << op;
+    } else {
+      pruned_error += gain[op];
+      _pruned_samples += _block_size;
+    }
+  }
+  return live;
+}
+
+/*
+  Largest change of the output when the OLs move from one set to another.
+  An OL scales its operator's output, and its modulation of each carrier
+  by 2pi per unit; as in live_operators, gain is the output change per
+  radian of phase of each operator.
+*/
+float FMSynth::ol_change_error(const std::array<float, 6>& from,
+                               const std::array<float, 6>& to) {
+  float gain[6];
+  float error = 0.0f;
+  for (int op = OP1; op <= OP6; op++) {
+    float op_gain = _outmatrix[op];
+    for (int carr_op = OP1; carr_op < op; carr_op++)
+      if (_modmatrix[carr_op * 6 + op]) op_gain += TWO_PI * gain[carr_op];
+    gain[op] = std::max(std::fabs(from[op]), std::fabs(to[op])) * op_gain;
+    error += std::fabs(to[op] - from[op]) * op_gain;
+  }
+  return error;
+}
+
+/*
+  Steady-state cycle cache. With constant OLs the output only depends on
+  the operator phases. Ratios are multiples of 1/200, so all operators
+  return to their starting phases after one cycle of
+  pitch * gcd(ratios * 200) / 200. When the OLs hold still, one such cycle
+  is rendered with the block kernel into _cycle, with at least
+  kCycleOversampling points per output sample. It is then played back with
+  cubic interpolation at whatever pitch comes.
+  The cycle is filled a block's worth of points at a time, while the
+  blocks are still rendered, so no block costs much more than two rendered
+  ones. The read position follows the phases meanwhile, and playback
+  starts on the block after the last point.
+  The cycle is dropped when the OLs move the output further than
+  _cycle_tolerance from it, or when the pitch falls below its
+  oversampling. A cycle is only started if the OLs, at their current rate
+  of change, would keep it for twice its render cost. Returns false when
+  the block has to be rendered.
+*/
+bool FMSynth::render_cycle(float pitch_hz, const std::array<float, 6>& inc_ol) {
+  std::array<float, 6> ol;  // At the end of the block
+  for (int i = 0; i < 6; i++)
+    ol[i] = _prev_ol[i] + inc_ol[i] * (float)_block_size;
+
+  if (_cycle_size > 0 || _cycle_fill_size > 0) {
+    // The OLs at the start of the block were checked by the block before.
+    const float step = _cycle_size * pitch_hz * _cycle_base * _t_step;
+    const float drift = ol_change_error(_cycle_ol, ol);
+    if (drift > _cycle_tolerance ||
+        (_cycle_size > 0 && step < kCycleOversampling))
+      drop_cycle();
+  }
+  if (_cycle_size == 0 && _cycle_fill_size == 0) {
+    // Skip the gcds while the OLs move too fast for the shortest cycle.
+    const float rate = ol_change_error(_prev_ol, ol) / (float)_block_size;
+    if (rate * 2.0f * kCycleChunk > _cycle_tolerance) return false;
+    // Ratio of op in 1/200ths: coarse (0 is 0.5) * (1 + fine / 100).
+    auto ratio = [this](int op) {
+      return (_fr_coarse[op] == 0 ? 1 : 2 * _fr_coarse[op]) *
+             (100 + _fr_fine[op]);
+    };
+    // Common cycle of the operators heard.
+    int base = 0;
+    for (int i = 0; i < 6; i++)
+      if (ol[i] != 0.0f) base = std::gcd(base, ratio(i));
+    if (base == 0) base = kRatioDenominator;
+    const float cycle_hz = pitch_hz * base / kRatioDenominator;
+    const float min_size = kCycleOversampling / (cycle_hz * _t_step);
+    if (!(min_size <= kMaxCycle)) return false;
+    int size = kCycleChunk;
+    while (size < min_size) size *= 2;
+    if (rate * 2.0f * size > _cycle_tolerance) return false;
+
+    _cycle_base = (float)base / kRatioDenominator;
+    for (int i = 0; i < 6; i++)
+      _cycle_turns[i] = (ol[i] != 0.0f) ? ratio(i) / base : 0;
+    _cycle_phase = _phase;
+    _cycle_ol = ol;
+    _cycle_pos = 0;
+    _cycle_fill_size = size;
+    _cycle_filled = 0;
+  }
+
+  // Read position in points, 32.32 fixed point: the size is a power of two,
+  // so it wraps with a mask.
+  const int size = (_cycle_size > 0) ? _cycle_size : _cycle_fill_size;
+  const double step = (double)size * pitch_hz * _cycle_base * _t_step;
+  const uint64_t step_fixed = (uint64_t)(step * 4294967296.0);
+  const uint64_t mask = ((uint64_t)size << 32) - 1;
+  if (_cycle_fill_size > 0) {
+    fill_cycle((_block_size + kCycleChunk - 1) / kCycleChunk * kCycleChunk);
+    _cycle_pos = (_cycle_pos + step_fixed * _block_size) & mask;
+    return false;
+  }
+
+  const float* cycle = _cycle.data() + 1;
+  uint64_t pos = _cycle_pos;
+  for (auto& sample : _buffer) {
+    const float t = (float)(uint32_t)pos * (1.0f / 4294967296.0f);
+    sample = interpolate_cubic(cycle + (pos >> 32) - 1, t);
+    pos = (pos + step_fixed) & mask;
+  }
+  _cycle_pos = pos;
+  const double x = pos / 4294967296.0;
+
+  // Leave the phases where the cycle is, for the blocks rendered next.
+  for (int i = 0; i < 6; i++) {
+    if (_cycle_turns[i] > 0) {
+      const double turns = _cycle_turns[i] * x / _cycle_size;
+      _phase[i] = wrap_phase(_cycle_phase[i] +
+                             TWO_PI * (float)(turns - std::floor(turns)));
+    } else {
+      _phase[i] = wrap_phase(_phase[i] + TWO_PI * pitch_hz * _fr[i] *
+                                             _t_step * (float)_block_size);
+    }
+  }
+  _cycle_samples += _block_size;
+  return true;
+}
+
+/*
+  Renders the next n_points (a multiple of kCycleChunk) of the cycle being
+  filled: _cycle_turns from _cycle_phase, at _cycle_ol. Every kCycleChunk
+  points restart from exact phases, so the cycle closes on itself. It can
+  be played once the last point is rendered.
+*/
+void FMSynth::fill_cycle(int n_points) {
+  const int size = _cycle_fill_size;
+  FMRenderState state;
+  state.ol = _cycle_ol;
+  state.ol_inc.fill(0.0f);
+  for (int i = 0; i < 6; i++)
+    state.phase_inc[i] = TWO_PI * (float)_cycle_turns[i] / (float)size;
+  float* cycle = _cycle.data() + 1;
+  const int end = std::min(_cycle_filled + n_points, size);
+  for (int start = _cycle_filled; start < end; start += kCycleChunk) {
+    for (int i = 0; i < 6; i++) {
+      const double turns = (double)_cycle_turns[i] * start / size;
+      state.phase[i] = wrap_phase(_cycle_phase[i] +
+                                  TWO_PI * (float)(turns - std::floor(turns)));
+    }
+    _block_kernel(_outmatrix, 0x3f, state, cycle + start, kCycleChunk);
+  }
+  _cycle_filled = end;
+  if (end < size) return;
+  // Wrapped points around the cycle for the interpolation.
+  cycle[-1] = cycle[size - 1];
+  cycle[size] = cycle[0];
+  cycle[size + 1] = cycle[1];
+  _cycle_size = size;
+  _cycle_fill_size = 0;
+}
+
+/* Reference: one sample at a time */
+void FMSynth::render_mm_scalar(float pitch_hz, std::array<float, 6> inc_ol) {
   std::array<float, 6> ol;
   ol = _prev_ol;
   const float scale = TWO_PI;  // standard scale for DX ( OLs go up to 2.0 )
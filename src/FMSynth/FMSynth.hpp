@@ -46,6 +46,11 @@ File: FMSynth.hpp
 #include <cstdint>
 
 #include "algorithms.hpp"
+#include "FMKernels.hpp"
+
+// Kernel of render_mm. SCALAR is the per-sample reference, the VECTOR kernels
+// render 4, 8 or 16 samples per iteration (see FMKernels.hpp).
+enum class FMRenderKernel { SCALAR, VECTOR4, VECTOR8, VECTOR16 };
 
 class FMSynth {
  public:
@@ -58,13 +63,50 @@ class FMSynth {
   unsigned int get_config();
   std::array<uint8_t, 6> get_fr_fine();
   std::array<uint8_t, 6> get_fr_coarse();
-  float* render(float pitch_hz, std::vector<float> ol);
+  float* render(float pitch_hz, const std::vector<float>& ol);
+  // Applies the algorithm and frequency ratios of a DX7 patch. Like the other
+  // setters, only call it from the thread that renders.
   void load_dx7_config(const std::array<uint8_t, 156> patch);
+  // The settings load_dx7_config applies, without touching a synth.
+  static void read_dx7_config(const std::array<uint8_t, 156>& patch,
+                              unsigned int& config,
+                              std::array<uint8_t, 6>& fr_coarse,
+                              std::array<uint8_t, 6>& fr_fine);
+  void set_render_kernel(FMRenderKernel kernel);
+  FMRenderKernel get_render_kernel();
+  // Sine of the operators in the VECTOR kernels. SCALAR always uses sinf.
+  void set_sine_engine(FMSineEngine engine);
+  FMSineEngine get_sine_engine();
+  // VECTOR kernels skip, block by block, the operators that can move the
+  // output by less than level in total: those with an OL near zero and the
+  // modulators that only feed skipped carriers. At 0 (the default) only
+  // silent operators are skipped, which does not change the output; a
+  // negative level renders every operator.
+  void set_prune_level(float level);
+  // Operator-samples skipped by pruning since init().
+  uint64_t get_pruned_samples();
+  // True once the last block rendered has faded out: rendering silent
+  // pitch again would only output zeros.
+  bool is_silent();
+  // VECTOR kernels play steady notes from a cached cycle of the output (see
+  // render_cycle) while the OLs keep it within tolerance of the output they
+  // would render. Negative (the default) renders every block.
+  void set_cycle_tolerance(float tolerance);
+  // Samples played from the cycle cache since init().
+  uint64_t get_cycle_samples();
 
  private:
   void update_phase(float pitch_hz);
   void reset_phase();
   void render_mm(float pitch_hz, std::array<float, 6> inc_ol);
+  void render_mm_scalar(float pitch_hz, std::array<float, 6> inc_ol);
+  void select_block_kernel();
+  unsigned live_operators(const std::array<float, 6>& inc_ol);
+  float ol_change_error(const std::array<float, 6>& from,
+                        const std::array<float, 6>& to);
+  bool render_cycle(float pitch_hz, const std::array<float, 6>& inc_ol);
+  void fill_cycle(int n_points);
+  void drop_cycle();
   void fade_out();
   void fade_in();
 
@@ -78,22 +120,23 @@ class FMSynth {
   int _block_size;
   float _t_step;
   std::vector<float> _buffer;
+  FMRenderKernel _render_kernel = FMRenderKernel::VECTOR8;
+  FMSineEngine _sine_engine = FMSineEngine::POLYNOMIAL;
+  FMBlockKernel _block_kernel = nullptr;  // Of the algorithm in _config
+  float _prune_level = 0.0f;
+  uint64_t _pruned_samples = 0;
+  float _cycle_tolerance = -1.0f;
+  uint64_t _cycle_samples = 0;
+  std::vector<float> _cycle;           // Cached cycle, between wrapped points
+  int _cycle_size = 0;                 // Points in the cycle, 0 = none
+  int _cycle_fill_size = 0;            // Points of the cycle being filled
+  int _cycle_filled = 0;               // Points of it rendered so far
+  uint64_t _cycle_pos = 0;             // Read position, 32.32 fixed point
+  float _cycle_base = 0.0f;            // Cycle frequency / pitch
+  std::array<int, 6> _cycle_turns;     // Turns of each operator per cycle
+  std::array<float, 6> _cycle_phase;   // Operator phases at point 0
+  std::array<float, 6> _cycle_ol;      // OLs the cycle was rendered with
 
   int _modmatrix[36] = {0};
   float _outmatrix[6] = {0};
-
-  std::array<const int*, 32> _mm_table = {
-      ALG1_MM,  ALG2_MM,  ALG3_MM,  ALG4_MM,  ALG5_MM,  ALG6_MM,  ALG7_MM,
-      ALG8_MM,  ALG9_MM,  ALG10_MM, ALG11_MM, ALG12_MM, ALG13_MM, ALG14_MM,
-      ALG15_MM, ALG16_MM, ALG17_MM, ALG18_MM, ALG19_MM, ALG20_MM, ALG21_MM,
-      ALG22_MM, ALG23_MM, ALG24_MM, ALG25_MM, ALG26_MM, ALG27_MM, ALG28_MM,
-      ALG29_MM, ALG30_MM, ALG31_MM, ALG32_MM};
-  std::array<const float*, 32> _outm_table = {
-      ALG1_OUTM,  ALG2_OUTM,  ALG3_OUTM,  ALG4_OUTM,  ALG5_OUTM,  ALG6_OUTM,
-      ALG7_OUTM,  ALG8_OUTM,  ALG9_OUTM,  ALG10_OUTM, ALG11_OUTM, ALG12_OUTM,
-      ALG13_OUTM, ALG14_OUTM, ALG15_OUTM, ALG16_OUTM, ALG17_OUTM, ALG18_OUTM,
-      ALG19_OUTM, ALG20_OUTM, ALG21_OUTM, ALG22_OUTM, ALG23_OUTM, ALG24_OUTM,
-      ALG25_OUTM, ALG26_OUTM, ALG27_OUTM, ALG28_OUTM, ALG29_OUTM, ALG30_OUTM,
-      ALG31_OUTM, ALG32_OUTM,
-  };
 };
@@ -38,133 +38,149 @@ Defines oscillator routing for FM modulation.
 
 #ifndef SRC_ALGORITHMS_HPP_
 #define SRC_ALGORITHMS_HPP_
-#endif  // SRC_ALGORITHMS_HPP_
 
-const int ALG1_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr int ALG1_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG1_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG2_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG1_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG2_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG2_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG3_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG2_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG3_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG3_OUTM[6] = {1, 0, 0, 1, 0, 0};
-const int ALG4_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG3_OUTM[6] = {1, 0, 0, 1, 0, 0};
+constexpr int ALG4_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG4_OUTM[6] = {1, 0, 0, 1, 0, 0};
-const int ALG5_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG4_OUTM[6] = {1, 0, 0, 1, 0, 0};
+constexpr int ALG5_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG5_OUTM[6] = {1, 0, 1, 0, 1, 0};
-const int ALG6_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG5_OUTM[6] = {1, 0, 1, 0, 1, 0};
+constexpr int ALG6_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG6_OUTM[6] = {1, 0, 1, 0, 1, 0};
-const int ALG7_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG6_OUTM[6] = {1, 0, 1, 0, 1, 0};
+constexpr int ALG7_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG7_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG8_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG7_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG8_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG8_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG9_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG8_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG9_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG9_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG10_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG9_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG10_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG10_OUTM[6] = {1, 0, 0, 1, 0, 0};
-const int ALG11_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG10_OUTM[6] = {1, 0, 0, 1, 0, 0};
+constexpr int ALG11_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG11_OUTM[6] = {1, 0, 0, 1, 0, 0};
-const int ALG12_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG11_OUTM[6] = {1, 0, 0, 1, 0, 0};
+constexpr int ALG12_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG12_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG13_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG12_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG13_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG13_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG14_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG13_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG14_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG14_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG15_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG14_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG15_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG15_OUTM[6] = {1, 0, 1, 0, 0, 0};
-const int ALG16_MM[36] = {0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG15_OUTM[6] = {1, 0, 1, 0, 0, 0};
+constexpr int ALG16_MM[36] = {0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG16_OUTM[6] = {1, 0, 0, 0, 0, 0};
-const int ALG17_MM[36] = {0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG16_OUTM[6] = {1, 0, 0, 0, 0, 0};
+constexpr int ALG17_MM[36] = {0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG17_OUTM[6] = {1, 0, 0, 0, 0, 0};
-const int ALG18_MM[36] = {0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG17_OUTM[6] = {1, 0, 0, 0, 0, 0};
+constexpr int ALG18_MM[36] = {0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG18_OUTM[6] = {1, 0, 0, 0, 0, 0};
-const int ALG19_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG18_OUTM[6] = {1, 0, 0, 0, 0, 0};
+constexpr int ALG19_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG19_OUTM[6] = {1, 0, 0, 1, 1, 0};
-const int ALG20_MM[36] = {0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG19_OUTM[6] = {1, 0, 0, 1, 1, 0};
+constexpr int ALG20_MM[36] = {0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG20_OUTM[6] = {1, 1, 0, 1, 0, 0};
-const int ALG21_MM[36] = {0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG20_OUTM[6] = {1, 1, 0, 1, 0, 0};
+constexpr int ALG21_MM[36] = {0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG21_OUTM[6] = {1, 1, 0, 1, 1, 0};
-const int ALG22_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG21_OUTM[6] = {1, 1, 0, 1, 1, 0};
+constexpr int ALG22_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG22_OUTM[6] = {1, 0, 1, 1, 1, 0};
-const int ALG23_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG22_OUTM[6] = {1, 0, 1, 1, 1, 0};
+constexpr int ALG23_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG23_OUTM[6] = {1, 1, 0, 1, 1, 0};
-const int ALG24_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG23_OUTM[6] = {1, 1, 0, 1, 1, 0};
+constexpr int ALG24_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG24_OUTM[6] = {1, 1, 1, 1, 1, 0};
-const int ALG25_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG24_OUTM[6] = {1, 1, 1, 1, 1, 0};
+constexpr int ALG25_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG25_OUTM[6] = {1, 1, 1, 1, 1, 0};
-const int ALG26_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG25_OUTM[6] = {1, 1, 1, 1, 1, 0};
+constexpr int ALG26_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG26_OUTM[6] = {1, 1, 0, 1, 0, 0};
-const int ALG27_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+constexpr float ALG26_OUTM[6] = {1, 1, 0, 1, 0, 0};
+constexpr int ALG27_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG27_OUTM[6] = {1, 1, 0, 1, 0, 0};
-const int ALG28_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG27_OUTM[6] = {1, 1, 0, 1, 0, 0};
+constexpr int ALG28_MM[36] = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG28_OUTM[6] = {1, 0, 1, 0, 0, 1};
-const int ALG29_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG28_OUTM[6] = {1, 0, 1, 0, 0, 1};
+constexpr int ALG29_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG29_OUTM[6] = {1, 1, 1, 0, 1, 0};
-const int ALG30_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG29_OUTM[6] = {1, 1, 1, 0, 1, 0};
+constexpr int ALG30_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG30_OUTM[6] = {1, 1, 1, 0, 0, 1};
-const int ALG31_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG30_OUTM[6] = {1, 1, 1, 0, 0, 1};
+constexpr int ALG31_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0};
-const float ALG31_OUTM[6] = {1, 1, 1, 1, 1, 0};
-const int ALG32_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+constexpr float ALG31_OUTM[6] = {1, 1, 1, 1, 1, 0};
+constexpr int ALG32_MM[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-const float ALG32_OUTM[6] = {1, 1, 1, 1, 1, 1};
+constexpr float ALG32_OUTM[6] = {1, 1, 1, 1, 1, 1};
+
+// Tables of the 32 algorithms, indexed by algorithm - 1.
+constexpr const int *ALG_MM_TABLE[32] = {
+    ALG1_MM,  ALG2_MM,  ALG3_MM,  ALG4_MM,  ALG5_MM,  ALG6_MM,  ALG7_MM,
+    ALG8_MM,  ALG9_MM,  ALG10_MM, ALG11_MM, ALG12_MM, ALG13_MM, ALG14_MM,
+    ALG15_MM, ALG16_MM, ALG17_MM, ALG18_MM, ALG19_MM, ALG20_MM, ALG21_MM,
+    ALG22_MM, ALG23_MM, ALG24_MM, ALG25_MM, ALG26_MM, ALG27_MM, ALG28_MM,
+    ALG29_MM, ALG30_MM, ALG31_MM, ALG32_MM};
+constexpr const float *ALG_OUTM_TABLE[32] = {
+    ALG1_OUTM,  ALG2_OUTM,  ALG3_OUTM,  ALG4_OUTM,  ALG5_OUTM,  ALG6_OUTM,
+    ALG7_OUTM,  ALG8_OUTM,  ALG9_OUTM,  ALG10_OUTM, ALG11_OUTM, ALG12_OUTM,
+    ALG13_OUTM, ALG14_OUTM, ALG15_OUTM, ALG16_OUTM, ALG17_OUTM, ALG18_OUTM,
+    ALG19_OUTM, ALG20_OUTM, ALG21_OUTM, ALG22_OUTM, ALG23_OUTM, ALG24_OUTM,
+    ALG25_OUTM, ALG26_OUTM, ALG27_OUTM, ALG28_OUTM, ALG29_OUTM, ALG30_OUTM,
+    ALG31_OUTM, ALG32_OUTM};
+
+#endif  // SRC_ALGORITHMS_HPP_
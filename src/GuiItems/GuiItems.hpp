@@ -130,7 +130,7 @@ private:
 
 
 // Status Bar, provides indications to users
-class StatusBarItem : public foleys::GuiItem
+class StatusBarItem : public foleys::GuiItem, juce::Timer
 {
 public:
     FOLEYS_DECLARE_GUI_FACTORY (StatusBarItem)
@@ -139,6 +139,8 @@ public:
     void update_status_message();
     // Sets label callback and updates model list.
     void update() override;
+    // Polls the inference deadline misses.
+    void timerCallback() override;
     juce::Component* getWrappedComponent() override
     {
         return &label;
@@ -52,12 +52,11 @@ void ModelComboBoxItem::update()
             if (auto* proc = dynamic_cast<BesselsProcessor*>(magicBuilder.getMagicState().getProcessor()))
             {
                 const auto selected_entry = combobox.getSelectedId() - 1;
-                // Stop Audio Processing Thread ( It can crash when re-loading model )
-                proc->suspendProcessing(true);
-                proc->reload_model(selected_entry);
-                proc->updateKnobs();
+                // Loads in the background, audio keeps running with the
+                // current model until the new one is ready. The audio thread
+                // applies its patch when it swaps it in, the knobs follow.
+                proc->reload_model(selected_entry, true);
                 proc->storeToValTree(ValTree_IDs::gui_params,"SelectedID",juce::var(combobox.getSelectedId()));
-                proc->suspendProcessing(false);
             
             auto *status_label = magicBuilder.findGuiItemWithId("lbl_status");
             if(status_label) status_label->update();
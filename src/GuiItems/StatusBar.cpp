@@ -41,6 +41,7 @@ Implements StatusBar GUI object.
 StatusBarItem::StatusBarItem (foleys::MagicGUIBuilder& builder, const juce::ValueTree& node) : foleys::GuiItem (builder, node)
 {
     addAndMakeVisible (label);
+    startTimerHz (2);
 }
 
 void StatusBarItem::update_status_message()
@@ -58,8 +59,14 @@ if (auto* processor = dynamic_cast<BesselsProcessor*>(magicBuilder.getMagicState
         else
         {
             // Check if a model is loaded
-            if(processor->_model.get() == nullptr)
+            if(processor->is_loading_model())
+                guiconfig->status = "Loading model...";
+            else if(!processor->has_model())
                 guiconfig->status = "Select a model from list.";
+            else if(processor->get_inference_misses() > 0)
+                guiconfig->status = "Ready to play! (" +
+                    std::to_string(processor->get_inference_misses()) +
+                    " late inference blocks)";
             else
                 guiconfig->status = "Ready to play!";       
         }
@@ -75,4 +82,9 @@ void StatusBarItem::update()
     auto *guiconfig = magicBuilder.getMagicState().getObjectWithType<PluginGUIConfig>("guiconfig");
     if(!guiconfig) return;
     label.setText(guiconfig->status,juce::dontSendNotification);
+}
+
+void StatusBarItem::timerCallback()
+{
+    update();
 }
\ No newline at end of file
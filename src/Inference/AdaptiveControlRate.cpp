@@ -0,0 +1,139 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: AdaptiveControlRate.cpp
+*/
+
+#include "AdaptiveControlRate.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void AdaptiveControlRate::set_tolerance(float tolerance) {
+  _tolerance = std::max(tolerance, 0.0f);
+  // Pitch is normalized as MIDI note / 127, so a relative frequency change
+  // r moves it by 12 * log2(1 + r) / 127.
+  _pitch_tolerance = 12.0f * std::log2(1.0f + _tolerance) / 127.0f;
+}
+
+void AdaptiveControlRate::set_max_stride(int max_stride) {
+  _max_stride = std::max(max_stride, 0);
+}
+
+void AdaptiveControlRate::prepare(int max_frames) {
+  if ((int)_keys.size() >= max_frames) return;
+  _keys.resize(max_frames);
+  _pitch.resize(max_frames);
+  _loudness.resize(max_frames);
+  _output.resize(max_frames * 6);
+}
+
+void AdaptiveControlRate::reset() {
+  _force_key = true;
+  _active = true;
+}
+
+bool AdaptiveControlRate::input_moved(float pitch, float loudness) const {
+  if (std::fabs(pitch - _key_pitch) > _pitch_tolerance) return true;
+  // Relative to the louder of the two, so onsets and releases are keys.
+  const float level = std::max(std::fabs(loudness), std::fabs(_key_loudness));
+  return std::fabs(loudness - _key_loudness) > _tolerance * level;
+}
+
+void AdaptiveControlRate::add_key(int k, int t, const float *pitch,
+                                  const float *loudness) {
+  _keys[k] = t;
+  _pitch[k] = pitch[t];
+  _loudness[k] = loudness[t];
+  _key_pitch = pitch[t];
+  _key_loudness = loudness[t];
+  _stride = 0;
+}
+
+int AdaptiveControlRate::call_sequence(EnvModel &model, const float *pitch,
+                                       const float *loudness, int n_frames,
+                                       float *output) {
+  if (n_frames <= 0) return 0;
+  if (!is_enabled() || n_frames > (int)_keys.size()) {
+    model.call_sequence(pitch, loudness, n_frames, output);
+    reset();  // No key frame to interpolate from
+    return 0;
+  }
+
+  int n_keys = 0;
+  for (int t = 0; t < n_frames; t++) {
+    const bool moved = input_moved(pitch[t], loudness[t]);
+    if (!moved && !_force_key && !_active && _stride < _max_stride &&
+        t < n_frames - 1) {
+      _stride++;
+      continue;
+    }
+    // The frame before a jump is a key frame too, so the envelopes do not
+    // move towards the new note before it is played.
+    if (moved && t > 0 && (n_keys == 0 || _keys[n_keys - 1] < t - 1))
+      add_key(n_keys++, t - 1, pitch, loudness);
+    add_key(n_keys++, t, pitch, loudness);
+    _force_key = false;
+  }
+  model.call_sequence(_pitch.data(), _loudness.data(), n_keys,
+                      _output.data());
+
+  // Scatter the key frames and interpolate the frames in between, starting
+  // from the last key frame of the previous call.
+  int prev = -1;
+  const float *prev_ol = _key_output.data();
+  float change = 0.0f;
+  for (int k = 0; k < n_keys; k++) {
+    const int key = _keys[k];
+    const float *key_ol = &_output[k * 6];
+    for (int t = prev + 1; t <= key; t++) {
+      const float a = (float)(t - prev) / (key - prev);
+      for (int i = 0; i < 6; i++)
+        output[t * 6 + i] = prev_ol[i] + a * (key_ol[i] - prev_ol[i]);
+    }
+    // Largest envelope change of a step, relative to the loudest envelope.
+    float delta = 0.0f, level = 0.0f;
+    for (int i = 0; i < 6; i++) {
+      delta = std::max(delta, std::fabs(key_ol[i] - prev_ol[i]));
+      level = std::max(level, std::fabs(key_ol[i]));
+    }
+    change = std::max(change, delta / std::max(level, 1e-3f));
+    prev = key;
+    prev_ol = key_ol;
+  }
+  std::copy(prev_ol, prev_ol + 6, _key_output.begin());
+  _active = change > _tolerance;
+  return n_frames - n_keys;
+}
@@ -0,0 +1,97 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: AdaptiveControlRate.hpp
+Steps an envelope model at a reduced control rate while its input is steady.
+
+While a note is held, the pitch and loudness fed to the model barely change
+from one fmblock to the next, and neither do the envelopes it returns. In
+that case most steps can be skipped: the model runs on key frames only and
+the envelopes of the frames in between are interpolated linearly.
+
+A frame is a key frame if its pitch or loudness moved more than the
+tolerance since the last key frame (onsets, releases, note changes), and so
+is the frame before it. Every frame is a key frame after a reset and while
+the envelopes moved more than the tolerance in a step of the previous call.
+At most max_stride frames are skipped in a row, and the last frame of a
+sequence is always a key frame, so every skipped frame lies between two
+computed ones. The key frames of a sequence run as one shorter sequence:
+the model state only sees key frames.
+
+Tolerance is a relative change: of the frequency (0.01 is about 17 cents),
+of the loudness, and of the envelopes per model step. 0 runs every step.
+The pipelined mode steps every frame on its worker and does not use this.
+*/
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "EnvModels.hpp"
+
+class AdaptiveControlRate {
+ public:
+  void set_tolerance(float tolerance);
+  void set_max_stride(int max_stride);
+  bool is_enabled() const { return _tolerance > 0.0f; }
+  // Preallocates buffers for sequences of up to max_frames frames.
+  void prepare(int max_frames);
+  // The model was reset or replaced: its next frame is a key frame.
+  void reset();
+  // Same contract as EnvModel::call_sequence. Returns the number of steps
+  // skipped. Runs every step while disabled.
+  int call_sequence(EnvModel &model, const float *pitch, const float *loudness,
+                    int n_frames, float *output);
+
+ private:
+  bool input_moved(float pitch, float loudness) const;
+  void add_key(int k, int t, const float *pitch, const float *loudness);
+
+  float _tolerance = 0.0f;
+  float _pitch_tolerance = 0.0f;  // In normalized pitch units
+  int _max_stride = 4;
+  // Last key frame, from this call or the previous one.
+  float _key_pitch = 0.0f;
+  float _key_loudness = 0.0f;
+  std::array<float, 6> _key_output = {0};
+  int _stride = 0;           // Frames skipped since the last key frame
+  bool _force_key = true;
+  bool _active = true;       // Envelopes moved at the end of the last call
+  std::vector<int> _keys;    // Key frames of the current call
+  std::vector<float> _pitch; // Compacted inputs and outputs
+  std::vector<float> _loudness;
+  std::vector<float> _output;
+};
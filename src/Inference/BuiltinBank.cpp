@@ -0,0 +1,207 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: BuiltinBank.cpp
+*/
+
+#include "BuiltinBank.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifndef BESSELS_BUILTIN_BANK
+#define BESSELS_BUILTIN_BANK 0
+#endif
+
+#if BESSELS_BUILTIN_BANK
+// Defined in the generated builtin_bank.cpp.
+extern const BuiltinModel *const builtin_bank[];
+extern const int builtin_bank_size;
+#endif
+
+namespace {
+
+// Float literals that read back bit-exact.
+void write_floats(std::ofstream &out, const char *name, const float *values,
+                  size_t count) {
+  out << "alignas(64) constexpr float " << name << "[" << count << "] = {";
+  out << std::hexfloat;
+  for (size_t i = 0; i < count; i++)
+    out << (i % 8 == 0 ? "\n    " : " ") << values[i] << "f,";
+  out << std::defaultfloat << "};\n";
+}
+
+void write_layers(std::ofstream &out, const char *name,
+                  const std::vector<NativeLinear> &layers) {
+  for (size_t l = 0; l < layers.size(); l++) {
+    const NativeLinear &layer = layers[l];
+    const std::string prefix = name + std::to_string(l);
+    write_floats(out, (prefix + "_weight").c_str(), layer.weight,
+                 (size_t)layer.in_features * layer.out_features);
+    if (layer.bias)
+      write_floats(out, (prefix + "_bias").c_str(), layer.bias,
+                   layer.out_features);
+  }
+  if (layers.empty()) return;
+  out << "constexpr BuiltinLayer " << name << "[] = {\n";
+  for (size_t l = 0; l < layers.size(); l++) {
+    const NativeLinear &layer = layers[l];
+    const std::string prefix = name + std::to_string(l);
+    out << "    {" << layer.in_features << ", " << layer.out_features << ", "
+        << (layer.relu ? "true" : "false") << ", " << prefix << "_weight, "
+        << (layer.bias ? prefix + "_bias" : "nullptr") << "},\n";
+  }
+  out << "};\n";
+}
+
+}  // namespace
+
+const std::vector<const BuiltinModel *> &builtin_models() {
+#if BESSELS_BUILTIN_BANK
+  static const std::vector<const BuiltinModel *> models(
+      builtin_bank, builtin_bank + builtin_bank_size);
+#else
+  static const std::vector<const BuiltinModel *> models;
+#endif
+  return models;
+}
+
+std::string builtin_model_path(const BuiltinModel &model) {
+  return BUILTIN_MODEL_PREFIX + std::string(model.name);
+}
+
+bool is_builtin_model(const std::string &path) {
+  return path.compare(0, std::strlen(BUILTIN_MODEL_PREFIX),
+                      BUILTIN_MODEL_PREFIX) == 0;
+}
+
+const BuiltinModel *find_builtin_model(const std::string &path) {
+  if (!is_builtin_model(path)) return nullptr;
+  const std::string name = path.substr(std::strlen(BUILTIN_MODEL_PREFIX));
+  for (const BuiltinModel *model : builtin_models())
+    if (name == model->name) return model;
+  return nullptr;
+}
+
+void load_builtin_weights(const BuiltinModel &model, NativeGRUWeights &weights,
+                          std::array<uint8_t, 156> &patch, bool &has_patch) {
+  weights = NativeGRUWeights();
+  auto add_layers = [](const BuiltinLayer *layers, int n,
+                       std::vector<NativeLinear> &out) {
+    for (int l = 0; l < n; l++) {
+      NativeLinear layer;
+      layer.in_features = layers[l].in_features;
+      layer.out_features = layers[l].out_features;
+      layer.relu = layers[l].relu;
+      layer.weight = layers[l].weight;
+      layer.bias = layers[l].bias;
+      out.push_back(layer);
+    }
+  };
+  add_layers(model.pre, model.n_pre, weights.pre);
+  add_layers(model.post, model.n_post, weights.post);
+  weights.gru_input = model.gru_input;
+  weights.hidden = model.hidden;
+  weights.w_ih = model.w_ih;
+  weights.w_hh = model.w_hh;
+  weights.b_ih = model.b_ih;
+  weights.b_hh = model.b_hh;
+  weights.output_scale = model.output_scale;
+  has_patch = (model.patch != nullptr);
+  if (has_patch) std::memcpy(patch.data(), model.patch, patch.size());
+}
+
+bool write_builtin_model(const std::string &filename, const std::string &symbol,
+                         const std::string &name,
+                         const NativeGRUWeights &weights,
+                         const std::array<uint8_t, 156> *patch) {
+  std::ofstream out(filename);
+  if (!out) {
+    std::cerr << "[BUILTIN BANK] Could not write " << filename << std::endl;
+    return false;
+  }
+  const size_t H = weights.hidden;
+  out << "// Built-in model \"" << name << "\". Generated by "
+      << "BesselsTrickConverter --bank, do not edit.\n\n"
+      << "#include \"BuiltinBank.hpp\"\n\nnamespace {\n\n";
+  write_layers(out, "pre", weights.pre);
+  write_floats(out, "w_ih", weights.w_ih, 3 * H * weights.gru_input);
+  write_floats(out, "w_hh", weights.w_hh, 3 * H * H);
+  write_floats(out, "b_ih", weights.b_ih, 3 * H);
+  write_floats(out, "b_hh", weights.b_hh, 3 * H);
+  write_layers(out, "post", weights.post);
+  if (patch) {
+    out << "constexpr uint8_t patch[156] = {";
+    for (size_t i = 0; i < patch->size(); i++)
+      out << (i % 16 == 0 ? "\n    " : " ") << (int)(*patch)[i] << ",";
+    out << "};\n";
+  }
+  // Escaped, model names come from file names.
+  std::string literal;
+  for (char c : name) {
+    if (c == '"' || c == '\\') literal += '\\';
+    literal += c;
+  }
+  out << "\n}  // namespace\n\n"
+      << "extern const BuiltinModel " << symbol << " = {\n"
+      << "    \"" << literal << "\", " << weights.gru_input << ", " << H
+      << ", " << std::hexfloat << weights.output_scale << std::defaultfloat
+      << "f,\n"
+      << "    " << (weights.pre.empty() ? "nullptr" : "pre") << ", "
+      << weights.pre.size() << ", post, " << weights.post.size() << ",\n"
+      << "    w_ih, w_hh, b_ih, b_hh, " << (patch ? "patch" : "nullptr")
+      << "};\n";
+  return (bool)out;
+}
+
+bool write_builtin_bank(const std::string &filename,
+                        const std::vector<std::string> &symbols) {
+  std::ofstream out(filename);
+  if (!out) {
+    std::cerr << "[BUILTIN BANK] Could not write " << filename << std::endl;
+    return false;
+  }
+  out << "// Built-in model bank. Generated by BesselsTrickConverter --bank, "
+      << "do not edit.\n\n#include \"BuiltinBank.hpp\"\n\n";
+  for (const auto &symbol : symbols)
+    out << "extern const BuiltinModel " << symbol << ";\n";
+  out << "\nextern const BuiltinModel *const builtin_bank[] = {\n";
+  for (const auto &symbol : symbols) out << "    &" << symbol << ",\n";
+  if (symbols.empty()) out << "    nullptr,\n";
+  out << "};\nextern const int builtin_bank_size = " << symbols.size()
+      << ";\n";
+  return (bool)out;
+}
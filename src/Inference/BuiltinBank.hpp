@@ -0,0 +1,104 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: BuiltinBank.hpp
+Envelope models compiled into the plugin binary.
+
+`BesselsTrickConverter --bank` turns a set of models into C++ translation
+units: the weights become constexpr, 64-byte aligned arrays and the DX7
+patch a byte array. A built-in model needs no file I/O, no parse and no
+warm-up: its weights are in the read-only data of the binary. The
+BESSELS_BUILTIN_BANK CMake option generates and links them, the way
+juce_add_binary_data embeds the algorithm images.
+
+Built-in models are addressed as "builtin:<name>" and run on the native
+engine. Without the option the bank is empty.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "NativeInference.hpp"
+
+constexpr const char *BUILTIN_MODEL_PREFIX = "builtin:";
+
+struct BuiltinLayer {
+  int in_features;
+  int out_features;
+  bool relu;
+  const float *weight;  // [out_features x in_features], row major
+  const float *bias;    // [out_features] or nullptr
+};
+
+// Generated by the converter, see the layout of NativeGRUWeights.
+struct BuiltinModel {
+  const char *name;
+  int gru_input;
+  int hidden;
+  float output_scale;
+  const BuiltinLayer *pre;  // Input MLP, n_pre layers
+  int n_pre;
+  const BuiltinLayer *post;  // Output MLP, n_post layers
+  int n_post;
+  const float *w_ih;
+  const float *w_hh;
+  const float *b_ih;
+  const float *b_hh;
+  const uint8_t *patch;  // 156 bytes, or nullptr
+};
+
+// Every model of the bank, in the order they were generated.
+const std::vector<const BuiltinModel *> &builtin_models();
+std::string builtin_model_path(const BuiltinModel &model);
+bool is_builtin_model(const std::string &path);
+// nullptr if path does not name a model of the bank.
+const BuiltinModel *find_builtin_model(const std::string &path);
+
+// Points the weight views at the arrays of model, nothing is copied.
+void load_builtin_weights(const BuiltinModel &model, NativeGRUWeights &weights,
+                          std::array<uint8_t, 156> &patch, bool &has_patch);
+
+// Writes the translation unit of one model, with the definition of symbol.
+bool write_builtin_model(const std::string &filename, const std::string &symbol,
+                         const std::string &name,
+                         const NativeGRUWeights &weights,
+                         const std::array<uint8_t, 156> *patch);
+// Writes the table of the bank, referencing the symbols of every model.
+bool write_builtin_bank(const std::string &filename,
+                        const std::vector<std::string> &symbols);
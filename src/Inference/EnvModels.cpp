@@ -37,27 +37,44 @@ File: EnvModels.cpp
 
 #include "EnvModels.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
 
+#include "BuiltinBank.hpp"
+
+#if BESSELS_WITH_LIBTORCH
 /*
     GRU based model
         Retains state internally - only requires the current conditioning value
+        The state stays inside TorchModel as a persistent tensor.
 */
 
-std::vector<float> GRUModel::call(float pitch, float loudness) {
+void GRUModel::call(float pitch, float loudness, std::vector<float> &output) {
   std::array<float, 2> inbuffer;
   inbuffer[0] = normalize_pitch(pitch);
   inbuffer[1] = normalize_loudness(loudness);
+  _torchmodel->call(inbuffer, output);
+}
 
-  if (_isStandalone)
-    _torchmodel->call(inbuffer, _outbuffer);
-  else
-    _torchmodel->call(inbuffer, _outbuffer, _statebuffer);
+void GRUModel::call_sequence(const float *pitch, const float *loudness,
+                             int n_frames, float *output) {
+  normalize_sequence(pitch, loudness, n_frames);
+  _torchmodel->call_sequence(_seqbuffer.data(), n_frames, output);
+}
 
-  return _outbuffer;
+void GRUModel::prepare_sequence(int max_frames) {
+  EnvModel::prepare_sequence(max_frames);
+  _torchmodel->prepare_sequence(max_frames);
 }
 
-std::vector<float> GRUModel::get_state() { return _statebuffer; }
+std::vector<float> GRUModel::get_state() {
+  std::vector<float> state;
+  _torchmodel->get_state(state);
+  return state;
+}
 
 void GRUModel::init(const std::string &filename,
                     std::array<int, 3> model_input_sizes, int n_outputs) {
@@ -67,11 +84,13 @@ void GRUModel::init(const std::string &filename,
 bool GRUModel::reset_state() {
   if (_isStandalone == true)
     return false;
-  else
-    std::fill(_statebuffer.begin(), _statebuffer.end(), 0.0f);
-  return true;
+  return _torchmodel->reset_state();
 }
 
+size_t GRUModel::get_weights_size() { return _torchmodel->get_weights_size(); }
+
+const void *GRUModel::get_weights_id() { return _torchmodel->get_weights_id(); }
+
 void GRUModel::init(const std::string &filename,
                     std::array<int, 3> model_input_sizes, int n_outputs,
                     int n_state) {
@@ -82,20 +101,116 @@ void GRUModel::init(const std::string &filename,
   config.output_len = n_outputs;
   config.rolling_slice = 2;
   config.state_len = n_state;
+  config.optimization = _optimization;
   _isStandalone = (n_state > 0) ? false : true;
-  _torchmodel->init(config);
+  _isLoaded = _torchmodel->init(config);
+  if (!_isLoaded) return;
   if (_torchmodel->contains_patch()) {
     _containsPatch = true;
     _torchmodel->get_patch(_initial_patch);
   }
-  _outbuffer.resize(n_outputs);
-  _statebuffer.resize(n_state);
 }
 
-EnvModel::EnvModel() { _torchmodel.reset(new TorchModel()); }
+GRUModel::GRUModel(TorchOptimization optimization)
+    : _optimization(optimization) {
+  _torchmodel.reset(new TorchModel());
+}
+#endif
+
+/*
+    Native GRU model
+        Same interface as GRUModel, stepped without libtorch.
+*/
+
+NativeGRUModel::NativeGRUModel() { _nativemodel.reset(new NativeGRU()); }
+
+void NativeGRUModel::call(float pitch, float loudness,
+                          std::vector<float> &output) {
+  std::array<float, 2> inbuffer;
+  inbuffer[0] = normalize_pitch(pitch);
+  inbuffer[1] = normalize_loudness(loudness);
+  _nativemodel->call(inbuffer, output, _statebuffer);
+}
+
+void NativeGRUModel::call_sequence(const float *pitch, const float *loudness,
+                                   int n_frames, float *output) {
+  normalize_sequence(pitch, loudness, n_frames);
+  _nativemodel->call_sequence(_seqbuffer.data(), n_frames, output,
+                              _statebuffer);
+}
+
+void NativeGRUModel::prepare_sequence(int max_frames) {
+  EnvModel::prepare_sequence(max_frames);
+  _nativemodel->prepare_sequence(max_frames);
+}
+
+std::vector<float> NativeGRUModel::get_state() { return _statebuffer; }
+
+bool NativeGRUModel::reset_state() {
+  std::fill(_statebuffer.begin(), _statebuffer.end(), 0.0f);
+  return true;
+}
+
+size_t NativeGRUModel::get_weights_size() {
+  return _nativemodel->get_weights_size();
+}
+
+const void *NativeGRUModel::get_weights_id() {
+  return _nativemodel->get_data().get();
+}
+
+void NativeGRUModel::init(const std::string &filename,
+                          std::array<int, 3> model_input_sizes,
+                          int n_outputs) {
+  init(filename, model_input_sizes, n_outputs, 0);
+}
+
+void NativeGRUModel::init(const std::string &filename,
+                          std::array<int, 3> model_input_sizes, int n_outputs,
+                          int n_state) {
+  _isStandalone = false;
+  // The native graphs take (pitch, loudness) frames.
+  if (model_input_sizes[2] != 2) {
+    std::cout << "[NATIVE MODEL] Expected 2 input features, not "
+              << model_input_sizes[2] << std::endl;
+    _isLoaded = false;
+    return;
+  }
+  _isLoaded = _nativemodel->init(filename, n_outputs);
+  if (!_isLoaded) return;
+  // The state size is taken from the weights, not from the caller.
+  if (n_state != 0 && n_state != _nativemodel->get_state_len())
+    std::cout << "[NATIVE MODEL] State size is "
+              << _nativemodel->get_state_len() << ", not " << n_state
+              << std::endl;
+  if (_nativemodel->contains_patch()) {
+    _containsPatch = true;
+    _nativemodel->get_patch(_initial_patch);
+  }
+  _statebuffer.assign(_nativemodel->get_state_len(), 0.0f);
+}
+
+EnvModel::EnvModel() {}
 
 EnvModel::~EnvModel() {}
 
+size_t EnvModel::get_weights_size() { return 0; }
+
+const void *EnvModel::get_weights_id() { return this; }
+
+void EnvModel::prepare_sequence(int max_frames) {
+  if ((int)_seqbuffer.size() < 2 * max_frames) _seqbuffer.resize(2 * max_frames);
+}
+
+void EnvModel::normalize_sequence(const float *pitch, const float *loudness,
+                                  int n_frames) {
+  if ((int)_seqbuffer.size() < 2 * n_frames) prepare_sequence(n_frames);
+  for (int t = 0; t < n_frames; t++) {
+    _seqbuffer[2 * t] = normalize_pitch(pitch[t]);
+    _seqbuffer[2 * t + 1] = normalize_loudness(loudness[t]);
+  }
+}
+
 inline float EnvModel::normalize_pitch(float pitch) {
   if (pitch < 20.0f) return 0.0f;
   constexpr float midi_highest_note = 127.0f;
@@ -117,3 +232,65 @@ inline float EnvModel::normalize_loudness(float loudness) {
   /* Scale [-DB_RANGE, 0] to [0, 1]. */
   return (ld_squared_db / _DB_RANGE) + 1.0f;
 }
+
+/*
+    Backends
+        Native first, create_env_model tries them in order of preference.
+*/
+
+namespace {
+
+// TorchScript archives are zip files.
+bool is_torchscript_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[4] = {0};
+  file.read(magic, sizeof(magic));
+  return file.good() && std::memcmp(magic, "PK\x03\x04", 4) == 0;
+}
+
+bool native_reads(const std::string &path) {
+  return is_builtin_model(path) || is_flat_model_file(path) ||
+         is_torchscript_file(path);
+}
+
+std::unique_ptr<EnvModel> create_native(const std::string &path,
+                                        const BackendOptions &options) {
+  std::unique_ptr<EnvModel> model(new NativeGRUModel());
+  model->init(path, {1, 1, 2}, 6, options.n_state);
+  if (!model->is_loaded()) return nullptr;
+  return model;
+}
+
+#if BESSELS_WITH_LIBTORCH
+bool torch_reads(const std::string &path) {
+  return is_torchscript_file(path);
+}
+
+std::unique_ptr<EnvModel> create_torch(const std::string &path,
+                                       const BackendOptions &options) {
+  apply_inference_thread_policy(options.thread_policy);
+  set_torch_executor(options.torch_executor);
+  std::unique_ptr<EnvModel> model(new GRUModel(options.torch_optimization));
+  model->init(path, {1, 1, 2}, 6, options.n_state);
+  if (!model->is_loaded()) return nullptr;
+  return model;
+}
+#endif
+
+}  // namespace
+
+const std::vector<InferenceBackend> &inference_backends() {
+  static const std::vector<InferenceBackend> backends = {
+      {"native", &native_reads, &create_native},
+#if BESSELS_WITH_LIBTORCH
+      {"libtorch", &torch_reads, &create_torch},
+#endif
+  };
+  return backends;
+}
+
+const InferenceBackend *find_inference_backend(const std::string &name) {
+  for (const auto &backend : inference_backends())
+    if (name == backend.name) return &backend;
+  return nullptr;
+}
@@ -37,7 +37,14 @@ Introuduce wrapper classes to hide Libtorch implementation of
 the Envelope RNNs.
 */
 
-#include "TorchInference.hpp" 
+#pragma once
+
+#include "FlatModel.hpp"
+#include "InferenceBackend.hpp"
+#include "NativeInference.hpp"
+#if BESSELS_WITH_LIBTORCH
+#include "TorchInference.hpp"
+#endif
 
 class EnvModel {
  public:
@@ -47,33 +54,87 @@ class EnvModel {
                     std::array<int, 3> model_input_sizes, int n_outputs,
                     int n_state) = 0;
   virtual std::vector<float> get_state() = 0;
-  virtual std::vector<float> call(float pitch, float loudness) = 0;
+  // Writes the envelopes into output, which the caller sizes to n_outputs.
+  // Does not allocate.
+  virtual void call(float pitch, float loudness,
+                    std::vector<float> &output) = 0;
+  // Runs n_frames consecutive steps with one inference call. output receives
+  // [n_frames x n_outputs] values, row major. Call prepare_sequence first.
+  virtual void call_sequence(const float *pitch, const float *loudness,
+                             int n_frames, float *output) = 0;
+  // Preallocates buffers for sequences of up to max_frames frames.
+  virtual void prepare_sequence(int max_frames);
   virtual bool reset_state() = 0;
+  // Bytes of weights the model keeps in memory, and the object holding
+  // them. Models sharing weights through WeightRegistry return the same id.
+  virtual size_t get_weights_size();
+  virtual const void *get_weights_id();
   virtual ~EnvModel();
   bool is_standalone() { return _isStandalone; }
+  bool is_loaded() { return _isLoaded; }
   bool contains_patch() { return _containsPatch; }
   std::array<uint8_t, 156> get_patch() { return _initial_patch; }
 
  protected:
   EnvModel();
-  std::unique_ptr<TorchModel> _torchmodel;
   // We have to use vector cause we dont know the size yet until init is called
-  std::vector<float> _outbuffer;
   std::vector<float> _statebuffer;
+  std::vector<float> _seqbuffer;  // Normalized [max_frames x 2] inputs
   bool _isStandalone = false;
+  bool _isLoaded = false;
   bool _containsPatch = false;
   float normalize_pitch(float pitch);
   float normalize_loudness(float loudness);
+  void normalize_sequence(const float *pitch, const float *loudness,
+                          int n_frames);
   std::array<uint8_t, 156> _initial_patch = {0};
 };
 
+#if BESSELS_WITH_LIBTORCH
 class GRUModel : public EnvModel {
  public:
-  std::vector<float> call(float pitch, float loudness) override;
+  // optimization selects the graph passes run on the module after loading.
+  GRUModel(TorchOptimization optimization =
+               TorchOptimization::FREEZE_AND_OPTIMIZE);
+  void call(float pitch, float loudness, std::vector<float> &output) override;
+  void call_sequence(const float *pitch, const float *loudness, int n_frames,
+                     float *output) override;
+  void prepare_sequence(int max_frames) override;
+  std::vector<float> get_state() override;
+  bool reset_state() override;
+  size_t get_weights_size() override;
+  const void *get_weights_id() override;
+  void init(const std::string &filename, std::array<int, 3> model_input_sizes,
+            int n_outputs) override;
+  void init(const std::string &filename, std::array<int, 3> model_input_sizes,
+            int n_outputs, int n_state) override;
+
+ private:
+  std::unique_ptr<TorchModel> _torchmodel;
+  TorchOptimization _optimization;
+};
+#endif
+
+/*
+  GRU model stepped by the native SIMD kernels, without libtorch.
+  Always keeps its hidden state exposed in _statebuffer.
+*/
+class NativeGRUModel : public EnvModel {
+ public:
+  NativeGRUModel();
+  void call(float pitch, float loudness, std::vector<float> &output) override;
+  void call_sequence(const float *pitch, const float *loudness, int n_frames,
+                     float *output) override;
+  void prepare_sequence(int max_frames) override;
   std::vector<float> get_state() override;
   bool reset_state() override;
+  size_t get_weights_size() override;
+  const void *get_weights_id() override;
   void init(const std::string &filename, std::array<int, 3> model_input_sizes,
             int n_outputs) override;
   void init(const std::string &filename, std::array<int, 3> model_input_sizes,
             int n_outputs, int n_state) override;
+
+ private:
+  std::unique_ptr<NativeGRU> _nativemodel;
 };
@@ -0,0 +1,253 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: FlatModel.cpp
+Implements writing and memory mapping of .btm model files.
+*/
+
+#include "FlatModel.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kPayloadAlign = 64;
+
+uint64_t align_up(uint64_t value) {
+  return (value + kPayloadAlign - 1) / kPayloadAlign * kPayloadAlign;
+}
+
+// Appends a tensor to the payload and returns its file offset.
+uint64_t append_tensor(std::vector<uint8_t> &file, const float *data,
+                       size_t numel) {
+  const uint64_t offset = align_up(file.size());
+  file.resize(offset + numel * sizeof(float), 0);
+  std::memcpy(file.data() + offset, data, numel * sizeof(float));
+  return offset;
+}
+
+bool in_range(uint64_t offset, uint64_t numel, size_t size) {
+  return offset % kPayloadAlign == 0 && offset + numel * sizeof(float) <= size;
+}
+
+}  // namespace
+
+uint64_t flat_model_hash(const uint8_t *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const size_t hash_field = offsetof(FlatModelHeader, content_hash);
+  for (size_t i = 0; i < size; i++) {
+    // The hash field itself reads as zero.
+    const uint8_t byte =
+        (i >= hash_field && i < hash_field + sizeof(uint64_t)) ? 0 : data[i];
+    hash ^= byte;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool write_flat_model(const std::string &filename,
+                      const NativeGRUWeights &weights, int n_outputs,
+                      const std::array<uint8_t, 156> *patch) {
+  const size_t n_layers = weights.pre.size() + weights.post.size();
+  std::vector<uint8_t> file(sizeof(FlatModelHeader) +
+                                n_layers * sizeof(FlatLayerEntry),
+                            0);
+  FlatModelHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, FLAT_MODEL_MAGIC, sizeof(header.magic));
+  header.version = FLAT_MODEL_VERSION;
+  header.n_pre = (uint32_t)weights.pre.size();
+  header.n_post = (uint32_t)weights.post.size();
+  header.gru_input = weights.gru_input;
+  header.hidden = weights.hidden;
+  header.n_outputs = n_outputs;
+  header.output_scale = weights.output_scale;
+  if (patch) {
+    header.has_patch = 1;
+    std::memcpy(header.patch, patch->data(), patch->size());
+  }
+
+  std::vector<FlatLayerEntry> layers;
+  auto add_layers = [&](const std::vector<NativeLinear> &block) {
+    for (const auto &layer : block) {
+      FlatLayerEntry entry;
+      std::memset(&entry, 0, sizeof(entry));
+      entry.in_features = layer.in_features;
+      entry.out_features = layer.out_features;
+      entry.relu = layer.relu ? 1 : 0;
+      entry.weight_offset = append_tensor(
+          file, layer.weight, (size_t)layer.in_features * layer.out_features);
+      if (layer.bias) {
+        entry.has_bias = 1;
+        entry.bias_offset =
+            append_tensor(file, layer.bias, layer.out_features);
+      }
+      layers.push_back(entry);
+    }
+  };
+  const size_t H = weights.hidden;
+  add_layers(weights.pre);
+  header.w_ih_offset = append_tensor(file, weights.w_ih, 3 * H * weights.gru_input);
+  header.w_hh_offset = append_tensor(file, weights.w_hh, 3 * H * H);
+  header.b_ih_offset = append_tensor(file, weights.b_ih, 3 * H);
+  header.b_hh_offset = append_tensor(file, weights.b_hh, 3 * H);
+  add_layers(weights.post);
+
+  header.file_size = file.size();
+  std::memcpy(file.data(), &header, sizeof(header));
+  std::memcpy(file.data() + sizeof(header), layers.data(),
+              layers.size() * sizeof(FlatLayerEntry));
+  header.content_hash = flat_model_hash(file.data(), file.size());
+  std::memcpy(file.data() + offsetof(FlatModelHeader, content_hash),
+              &header.content_hash, sizeof(uint64_t));
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "[FLAT MODEL] Could not write " << filename << std::endl;
+    return false;
+  }
+  out.write((const char *)file.data(), file.size());
+  return out.good();
+}
+
+FlatModelFile::FlatModelFile() {}
+
+FlatModelFile::~FlatModelFile() {
+  if (_data) munmap((void *)_data, _size);
+}
+
+bool FlatModelFile::open(const std::string &filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "[FLAT MODEL] Could not open " << filename << std::endl;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(FlatModelHeader)) {
+    ::close(fd);
+    return false;
+  }
+  void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // The mapping holds its own reference.
+  if (mapped == MAP_FAILED) return false;
+  _data = (const uint8_t *)mapped;
+  _size = info.st_size;
+
+  const FlatModelHeader *h = header();
+  if (std::memcmp(h->magic, FLAT_MODEL_MAGIC, 4) != 0 ||
+      h->version != FLAT_MODEL_VERSION || h->file_size != _size) {
+    std::cerr << "[FLAT MODEL] Invalid or unsupported file " << filename
+              << std::endl;
+    munmap((void *)_data, _size);
+    _data = nullptr;
+    _size = 0;
+    return false;
+  }
+  return true;
+}
+
+bool FlatModelFile::verify() const {
+  return _data && flat_model_hash(_data, _size) == header()->content_hash;
+}
+
+const FlatModelHeader *FlatModelFile::header() const {
+  return (const FlatModelHeader *)_data;
+}
+
+bool is_flat_model_file(const std::string &filename) {
+  const std::string ext(FLAT_MODEL_EXTENSION);
+  return filename.size() >= ext.size() &&
+         filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+bool load_flat_weights(const std::string &filename, NativeGRUWeights &weights,
+                       std::array<uint8_t, 156> &patch, bool &has_patch) {
+  auto file = std::make_shared<FlatModelFile>();
+  if (!file->open(filename)) return false;
+  const FlatModelHeader *h = file->header();
+  const uint8_t *base = file->data();
+  const size_t size = file->size();
+  const uint64_t H = h->hidden;
+
+  const size_t table_end = sizeof(FlatModelHeader) +
+                           (size_t)(h->n_pre + h->n_post) * sizeof(FlatLayerEntry);
+  if (table_end > size) return false;
+  const FlatLayerEntry *entries =
+      (const FlatLayerEntry *)(base + sizeof(FlatModelHeader));
+
+  weights = NativeGRUWeights();
+  for (uint32_t l = 0; l < h->n_pre + h->n_post; l++) {
+    const FlatLayerEntry &entry = entries[l];
+    NativeLinear layer;
+    layer.in_features = entry.in_features;
+    layer.out_features = entry.out_features;
+    layer.relu = entry.relu != 0;
+    if (!in_range(entry.weight_offset,
+                  (uint64_t)entry.in_features * entry.out_features, size))
+      return false;
+    layer.weight = (const float *)(base + entry.weight_offset);
+    if (entry.has_bias) {
+      if (!in_range(entry.bias_offset, entry.out_features, size)) return false;
+      layer.bias = (const float *)(base + entry.bias_offset);
+    }
+    (l < h->n_pre ? weights.pre : weights.post).push_back(layer);
+  }
+  if (!in_range(h->w_ih_offset, 3 * H * h->gru_input, size) ||
+      !in_range(h->w_hh_offset, 3 * H * H, size) ||
+      !in_range(h->b_ih_offset, 3 * H, size) ||
+      !in_range(h->b_hh_offset, 3 * H, size))
+    return false;
+  weights.gru_input = h->gru_input;
+  weights.hidden = h->hidden;
+  weights.w_ih = (const float *)(base + h->w_ih_offset);
+  weights.w_hh = (const float *)(base + h->w_hh_offset);
+  weights.b_ih = (const float *)(base + h->b_ih_offset);
+  weights.b_hh = (const float *)(base + h->b_hh_offset);
+  weights.output_scale = h->output_scale;
+  weights.mapping = file;
+
+  has_patch = h->has_patch != 0;
+  if (has_patch) std::memcpy(patch.data(), h->patch, patch.size());
+  return true;
+}
@@ -0,0 +1,123 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: FlatModel.hpp
+Flat, memory-mappable model format (.btm) for the native inference engine.
+
+Layout (little endian):
+    FlatModelHeader                    256 bytes
+    FlatLayerEntry[n_pre + n_post]     Input MLP layers, then output MLP
+    payload                            float32 tensors, 64-byte aligned
+
+All offsets are relative to the start of the file, so once the file is
+mapped the weights are used in place: no parse and no copy. content_hash is
+FNV-1a 64 of the whole file with the hash field set to zero.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "NativeInference.hpp"
+
+constexpr char FLAT_MODEL_MAGIC[4] = {'B', 'T', 'F', 'M'};
+constexpr uint32_t FLAT_MODEL_VERSION = 1;
+constexpr const char *FLAT_MODEL_EXTENSION = ".btm";
+
+struct FlatLayerEntry {
+  uint32_t in_features;
+  uint32_t out_features;
+  uint32_t relu;
+  uint32_t has_bias;
+  uint64_t weight_offset;
+  uint64_t bias_offset;
+};
+
+struct FlatModelHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t file_size;
+  uint64_t content_hash;
+  uint32_t n_pre;      // Input MLP layers
+  uint32_t n_post;     // Output MLP layers
+  uint32_t gru_input;
+  uint32_t hidden;     // GRU state size
+  uint32_t n_outputs;
+  uint32_t has_patch;
+  float output_scale;
+  uint32_t reserved0;
+  uint64_t w_ih_offset;
+  uint64_t w_hh_offset;
+  uint64_t b_ih_offset;
+  uint64_t b_hh_offset;
+  uint8_t patch[156];  // DX7 patch (VCED format) used for training
+  uint8_t reserved1[12];
+};
+static_assert(sizeof(FlatModelHeader) == 256, "FlatModelHeader must be 256 bytes");
+static_assert(sizeof(FlatLayerEntry) == 32, "FlatLayerEntry must be 32 bytes");
+
+uint64_t flat_model_hash(const uint8_t *data, size_t size);
+
+// Serializes a model. patch may be nullptr.
+bool write_flat_model(const std::string &filename,
+                      const NativeGRUWeights &weights, int n_outputs,
+                      const std::array<uint8_t, 156> *patch);
+
+// Read-only memory mapping of a .btm file.
+class FlatModelFile {
+ public:
+  FlatModelFile();
+  ~FlatModelFile();
+  bool open(const std::string &filename);
+  // Recomputes the content hash. Touches every page, so not done on load.
+  bool verify() const;
+  const FlatModelHeader *header() const;
+  const uint8_t *data() const { return _data; }
+  size_t size() const { return _size; }
+
+ private:
+  const uint8_t *_data = nullptr;
+  size_t _size = 0;
+};
+
+bool is_flat_model_file(const std::string &filename);
+
+// Maps a .btm file and points the weight views into the mapping, which is
+// kept alive by weights.mapping. patch is filled if the model has one.
+bool load_flat_weights(const std::string &filename, NativeGRUWeights &weights,
+                       std::array<uint8_t, 156> &patch, bool &has_patch);
@@ -0,0 +1,102 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InferenceBackend.hpp
+Registry of the engines envelope models can run on.
+
+Backends are selected at build time: the native engine is always built,
+libtorch only when BESSELS_WITH_LIBTORCH is set (see the BESSELS_NATIVE_ONLY
+CMake option). At load time create_env_model picks the first backend, in
+order of preference, that reads the format of the model file and supports
+its graph:
+
+    .btm    native
+    .ts     native, or libtorch for graphs the native engine can not run
+
+This header does not include libtorch, so it can be used by every build.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "InferenceThreading.hpp"
+
+#ifndef BESSELS_WITH_LIBTORCH
+#define BESSELS_WITH_LIBTORCH 1
+#endif
+
+class EnvModel;
+
+// Graph passes applied to a TorchScript module once it is loaded.
+enum class TorchOptimization {
+  NONE,
+  FREEZE,               // Inline parameters and attributes as constants
+  FREEZE_AND_OPTIMIZE,  // Then torch::jit::optimize_for_inference
+};
+
+// Graph executor of every TorchScript module in the process. PROFILING
+// specializes the graph on the inputs of its first runs, SIMPLE runs it as
+// loaded and LEGACY is the executor that predates profiling.
+enum class TorchExecutor { PROFILING, SIMPLE, LEGACY };
+
+// Settings a model is created with. Each backend ignores the ones that do
+// not apply to it.
+struct BackendOptions {
+  int n_state = 0;         // 0 for standalone models
+  TorchOptimization torch_optimization =
+      TorchOptimization::FREEZE_AND_OPTIMIZE;
+  TorchExecutor torch_executor = TorchExecutor::PROFILING;
+  // libtorch: applied by the first libtorch model of the process, so the
+  // runtime is set up when it is first needed.
+  InferenceThreadPolicy thread_policy;
+};
+
+struct InferenceBackend {
+  const char *name;
+  // True if the backend reads the format of path. Loading may still fail on
+  // graphs it does not support.
+  bool (*reads)(const std::string &path);
+  // Creates and initializes the model, nullptr if it could not be loaded.
+  std::unique_ptr<EnvModel> (*create)(const std::string &path,
+                                      const BackendOptions &options);
+};
+
+// Backends compiled into this build, native first.
+const std::vector<InferenceBackend> &inference_backends();
+// nullptr if no backend of that name was built.
+const InferenceBackend *find_inference_backend(const std::string &name);
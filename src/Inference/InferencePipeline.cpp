@@ -0,0 +1,168 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InferencePipeline.cpp
+*/
+
+#include "InferencePipeline.hpp"
+
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/*
+  Best effort: without the rights to raise its priority the worker still
+  runs, just with normal scheduling. macOS has no hard affinity, core is
+  ignored there.
+*/
+void make_realtime(std::thread &thread, int core) {
+#if defined(_WIN32)
+  HANDLE handle = (HANDLE)thread.native_handle();
+  if (!SetThreadPriority(handle, THREAD_PRIORITY_TIME_CRITICAL))
+    std::cout << "[PIPELINE] Could not raise worker priority" << std::endl;
+  if (core >= 0) SetThreadAffinityMask(handle, (DWORD_PTR)1 << core);
+#elif defined(__unix__) || defined(__APPLE__)
+  sched_param param;
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+  if (pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) != 0)
+    std::cout << "[PIPELINE] Could not raise worker priority" << std::endl;
+#if defined(__linux__)
+  if (core >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+  }
+#endif
+#endif
+  (void)thread;
+  (void)core;
+}
+
+}  // namespace
+
+InferencePipeline::~InferencePipeline() { stop(); }
+
+void InferencePipeline::start(int core) {
+  if (is_running()) return;
+  _ol.assign(6, 0.0f);
+  _ol_fade.assign(6, 0.0f);
+  _quit = false;
+  _completed = -1;
+  _worker = std::thread([this] { run(); });
+  make_realtime(_worker, core);
+}
+
+void InferencePipeline::stop() {
+  if (!is_running()) return;
+  _quit = true;
+  _worker.join();
+  while (_frames.front()) _frames.pop();
+  while (_results.front()) _results.pop();
+}
+
+bool InferencePipeline::push(const PipelineFrame &frame) {
+  return _frames.push(frame);
+}
+
+bool InferencePipeline::pop(int64_t index, std::array<float, 6> &ol) {
+  if (index < 0) {
+    ol.fill(0.0f);
+    return true;
+  }
+  while (true) {
+    const PipelineResult *result = _results.front();
+    if (result && result->index < index) {
+      _results.pop();  // Late result of a frame that was extrapolated
+      continue;
+    }
+    if (result && result->index == index) {
+      ol = result->ol;
+      _results.pop();
+      return true;
+    }
+    // Not done yet, or only later frames (index was never pushed).
+    return false;
+  }
+}
+
+void InferencePipeline::process(const PipelineFrame &frame) {
+  PipelineResult result;
+  result.index = frame.index;
+  if (frame.model == nullptr) {
+    result.ol[0] = 1.0f;  // Placeholder {1,0,0,0,0,0}
+  } else {
+    if (frame.reset) frame.model->reset_state();
+    frame.model->call_sequence(&frame.pitch, &frame.loudness, 1, _ol.data());
+    if (frame.fade_model) {
+      if (frame.reset) frame.fade_model->reset_state();
+      frame.fade_model->call_sequence(&frame.pitch, &frame.loudness, 1,
+                                      _ol_fade.data());
+    }
+    for (int i = 0; i < 6; i++)
+      result.ol[i] = frame.fade_model ? _ol_fade[i] + frame.fade_alpha *
+                                                          (_ol[i] - _ol_fade[i])
+                                      : _ol[i];
+  }
+  // The audio thread drains results every block, so this only spins if it
+  // stopped calling pop().
+  while (!_results.push(result) && !_quit) std::this_thread::yield();
+  _completed.store(frame.index, std::memory_order_release);
+}
+
+/*
+  Sleeps while the ring is empty. A result is only read one callback after
+  its frame is pushed (0.67 ms at 96 kHz), so waking up to 300 us late costs
+  nothing, and the worker does not hold a core between frames.
+*/
+void InferencePipeline::run() {
+  constexpr auto kIdleSleep = std::chrono::microseconds(300);
+  while (!_quit) {
+    const PipelineFrame *frame = _frames.front();
+    if (frame) {
+      process(*frame);
+      _frames.pop();
+    } else {
+      std::this_thread::sleep_for(kIdleSleep);
+    }
+  }
+}
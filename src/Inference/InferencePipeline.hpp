@@ -0,0 +1,147 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InferencePipeline.hpp
+Steps the envelope models on a real-time worker thread, one fmblock ahead.
+
+processBlock pushes the features of every fmblock into a lock-free SPSC
+ring. The worker steps the model frame by frame and publishes each envelope
+in a second ring. The audio thread renders fmblock f with the envelope of
+frame f-1 and never waits for it: a result that is not there is
+extrapolated. The cost is one fmblock of latency, which the processor
+reports to the host.
+
+That only takes inference out of the callback with host blocks of one
+fmblock (64 samples), where frame f-1 was pushed a whole callback earlier.
+With longer blocks frame f-1 is pushed in the same callback as f, so the
+processor runs inference inline instead (see prepareToPlay).
+
+The worker shortens the callback, it does not save CPU: on a single core,
+16 instances of HARP 2 spend 0.1 us instead of 13 us per callback (p50),
+but use about 40% more CPU time in total, mostly waking the workers up
+(`BesselsTrickBenchmark --pipeline`). The gain is on hosts with a core to
+spare for the workers.
+
+Models are not owned by the pipeline. Every frame carries the models to run
+it with, and the audio thread keeps a model alive until completed() has
+reached the last frame it pushed with it.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "EnvModels.hpp"
+
+// Single producer / single consumer ring of N - 1 elements.
+template <typename T, size_t N>
+class SpscRing {
+ public:
+  bool push(const T &item) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    const size_t next = (head + 1) % N;
+    if (next == _tail.load(std::memory_order_acquire)) return false;
+    _items[head] = item;
+    _head.store(next, std::memory_order_release);
+    return true;
+  }
+  // Returns nullptr if the ring is empty. The item stays valid until pop().
+  const T *front() {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) return nullptr;
+    return &_items[tail];
+  }
+  void pop() {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    _tail.store((tail + 1) % N, std::memory_order_release);
+  }
+
+ private:
+  std::array<T, N> _items;
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
+
+struct PipelineFrame {
+  int64_t index = 0;
+  EnvModel *model = nullptr;       // nullptr outputs the placeholder envelope
+  EnvModel *fade_model = nullptr;  // Replaced model during a crossfade
+  float fade_alpha = 1.0f;         // Weight of model against fade_model
+  float pitch = 0.0f;
+  float loudness = 0.0f;
+  bool reset = false;              // Reset the models before this frame
+};
+
+struct PipelineResult {
+  int64_t index = -1;
+  std::array<float, 6> ol = {0};
+};
+
+class InferencePipeline {
+ public:
+  ~InferencePipeline();
+  // Starts the worker with real-time priority, pinned to core if it is not
+  // negative. Not real time safe.
+  void start(int core);
+  // Joins the worker and drops queued frames and results.
+  void stop();
+  bool is_running() { return _worker.joinable(); }
+  // Audio thread. Returns false if the ring is full.
+  bool push(const PipelineFrame &frame);
+  // Audio thread. Takes the envelope of frame index if it is published,
+  // discarding older results. Frames before index 0 are silent. Returns
+  // false if the worker has not finished the frame yet. Never waits.
+  bool pop(int64_t index, std::array<float, 6> &ol);
+  // Index of the last frame the worker finished.
+  int64_t completed() { return _completed.load(std::memory_order_acquire); }
+
+ private:
+  void run();
+  void process(const PipelineFrame &frame);
+
+  static constexpr size_t kRingSize = 1024;
+  SpscRing<PipelineFrame, kRingSize> _frames;
+  SpscRing<PipelineResult, kRingSize> _results;
+  std::thread _worker;
+  std::atomic<bool> _quit{false};
+  std::atomic<int64_t> _completed{-1};
+  std::vector<float> _ol;  // Worker thread only
+  std::vector<float> _ol_fade;
+};
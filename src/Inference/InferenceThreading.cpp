@@ -0,0 +1,96 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InferenceThreading.cpp
+Implements the process-wide threading policy of the inference backends.
+*/
+
+#include "InferenceThreading.hpp"
+
+#include <iostream>
+#include <mutex>
+
+#include "InferenceBackend.hpp"
+
+#if BESSELS_WITH_LIBTORCH
+#include <ATen/Parallel.h>
+#include <c10/util/Exception.h>
+#endif
+
+namespace {
+
+std::mutex policy_mutex;
+bool policy_applied = false;
+InferenceThreadPolicy current_policy;
+
+}  // namespace
+
+bool apply_inference_thread_policy(const InferenceThreadPolicy &policy) {
+  std::lock_guard<std::mutex> lock(policy_mutex);
+  if (policy_applied) return false;
+  policy_applied = true;
+  current_policy = policy;
+#if BESSELS_WITH_LIBTORCH
+  try {
+    if (policy.intra_op_threads > 0)
+      at::set_num_threads(policy.intra_op_threads);
+    // Throws if the inter-op pool is already running.
+    if (policy.inter_op_threads > 0)
+      at::set_num_interop_threads(policy.inter_op_threads);
+  } catch (const c10::Error &e) {
+    std::cerr << "[INFERENCE THREADS] Could not size the libtorch pools: "
+              << e.what_without_backtrace() << std::endl;
+  }
+  std::cout << "[INFERENCE THREADS] intra-op " << at::get_num_threads()
+            << ", inter-op " << at::get_num_interop_threads() << std::endl;
+#endif
+  return true;
+}
+
+InferenceThreadPolicy get_inference_thread_policy() {
+  std::lock_guard<std::mutex> lock(policy_mutex);
+  return current_policy;
+}
+
+void init_inference_thread() {
+#if BESSELS_WITH_LIBTORCH
+  thread_local bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+  at::init_num_threads();
+  const int intra_op_threads = get_inference_thread_policy().intra_op_threads;
+  if (intra_op_threads > 0) at::set_num_threads(intra_op_threads);
+#endif
+}
@@ -0,0 +1,73 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InferenceThreading.hpp
+Process-wide threading policy of the inference backends.
+
+Every plugin instance in a host shares one libtorch runtime. With default
+settings each of them may fan a forward pass out over an intra-op pool of
+one thread per core, and the OpenMP workers behind that pool spin while
+they wait for work, so a handful of instances oversubscribe the machine and
+steal time from the audio threads. The envelope models are far too small to
+gain from intra-op parallelism, so the policy defaults to running every
+forward pass on the calling thread.
+
+The pools can only be sized once per process, before the first model is
+loaded: apply_inference_thread_policy keeps the first policy it is given.
+The native engine is single threaded and not affected.
+
+The OpenMP wait policy cannot be changed from here. libgomp reads
+OMP_WAIT_POLICY once, when it is loaded with libtorch, and setting
+environment variables while the host runs other threads is unsafe. To keep
+idle workers from spinning, start the host with OMP_WAIT_POLICY=PASSIVE
+(and KMP_BLOCKTIME=0 for libiomp5 builds) in its environment.
+*/
+
+#pragma once
+
+struct InferenceThreadPolicy {
+  int intra_op_threads = 1;  // Threads per forward pass. 0 = libtorch default
+  int inter_op_threads = 1;  // Threads for parallel graph branches. 0 = default
+};
+
+// Applies policy once per process. Returns false, and changes nothing, if a
+// policy was applied before. Call before the first model is loaded.
+bool apply_inference_thread_policy(const InferenceThreadPolicy &policy);
+// Policy in effect, the default one if none was applied.
+InferenceThreadPolicy get_inference_thread_policy();
+// Propagates the intra-op thread count to the calling thread. OpenMP keeps
+// it per thread, so every thread that runs libtorch models calls this before
+// its first forward pass. Cheap after the first call.
+void init_inference_thread();
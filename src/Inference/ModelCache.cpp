@@ -0,0 +1,141 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: ModelCache.cpp
+*/
+
+#include "ModelCache.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+
+#include "BuiltinBank.hpp"
+
+ModelCacheKey ModelCache::make_key(const std::string &path, int n_state,
+                                   bool prefer_native) {
+  ModelCacheKey key;
+  key.path = path;
+  key.n_state = n_state;
+  key.prefer_native = prefer_native;
+  if (find_builtin_model(path)) {
+    key.mtime = 1;  // Never changes
+    return key;
+  }
+  std::error_code error;
+  const auto mtime = std::filesystem::last_write_time(path, error);
+  if (!error) key.mtime = (int64_t)mtime.time_since_epoch().count();
+  return key;
+}
+
+void ModelCache::set_budget(size_t bytes) {
+  _budget = bytes;
+  evict(_budget);
+}
+
+bool ModelCache::contains(const ModelCacheKey &key) {
+  for (const auto &entry : _entries)
+    if (entry.key == key) return true;
+  return false;
+}
+
+std::unique_ptr<EnvModel> ModelCache::take(const ModelCacheKey &key) {
+  for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->key == key) {
+      std::unique_ptr<EnvModel> model = std::move(it->model);
+      erase(it);
+      _hits++;
+      return model;
+    }
+  }
+  _misses++;
+  return nullptr;
+}
+
+void ModelCache::put(const ModelCacheKey &key,
+                     std::unique_ptr<EnvModel> model) {
+  if (!model || key.mtime == 0) return;
+  const size_t cost = model->get_weights_size();
+  if (cost > _budget) return;
+
+  // Drop older versions of the same file and duplicates. Variants of the
+  // current version (state size, backend) may share their weights.
+  for (auto it = _entries.begin(); it != _entries.end();) {
+    if (it->key.path == key.path &&
+        (it->key.mtime != key.mtime || it->key == key))
+      it = erase(it);
+    else
+      ++it;
+  }
+  model->reset_state();
+  Entry entry;
+  entry.key = key;
+  entry.weights = model->get_weights_id();
+  entry.model = std::move(model);
+  entry.cost = cost;
+  if (!holds_weights(entry.weights)) {
+    evict(_budget - cost);
+    _size += cost;
+  }
+  _entries.push_front(std::move(entry));
+}
+
+bool ModelCache::holds_weights(const void *weights) const {
+  for (const auto &entry : _entries)
+    if (entry.weights == weights) return true;
+  return false;
+}
+
+/* Removes an entry, its weights stop counting with their last entry. */
+std::list<ModelCache::Entry>::iterator ModelCache::erase(
+    std::list<Entry>::iterator it) {
+  const void *weights = it->weights;
+  const size_t cost = it->cost;
+  it = _entries.erase(it);
+  if (!holds_weights(weights)) _size -= cost;
+  return it;
+}
+
+void ModelCache::evict(size_t budget) {
+  while (!_entries.empty() && _size > budget) {
+    std::cout << "[MODEL CACHE] Evicting " << _entries.back().key.path
+              << std::endl;
+    erase(std::prev(_entries.end()));
+  }
+}
+
+void ModelCache::clear() {
+  _entries.clear();
+  _size = 0;
+}
@@ -0,0 +1,106 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: ModelCache.hpp
+Bounded LRU cache of initialized envelope models.
+
+Entries are keyed by file path and modification time (plus the settings
+the model was created with), so an edited file is never served stale. The
+cost of an entry is the memory its loaded weights take, as the model
+reports it (built-in models cost nothing). Entries that share weights
+through WeightRegistry are charged once. Only idle models live in the
+cache: a model is taken out while the audio thread runs it and put back
+when it is replaced.
+
+Not thread safe, it is only used from the ModelLoader worker thread. The
+counters can be read from any thread.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "EnvModels.hpp"
+
+struct ModelCacheKey {
+  std::string path;
+  int64_t mtime = 0;
+  int n_state = 0;
+  bool prefer_native = true;
+  bool operator==(const ModelCacheKey &other) const {
+    return path == other.path && mtime == other.mtime &&
+           n_state == other.n_state && prefer_native == other.prefer_native;
+  }
+};
+
+class ModelCache {
+ public:
+  // Reads the modification time of path. Returns a key with mtime 0 if the
+  // file can not be read.
+  static ModelCacheKey make_key(const std::string &path, int n_state,
+                                bool prefer_native);
+  void set_budget(size_t bytes);
+  bool contains(const ModelCacheKey &key);
+  // Removes and returns the model stored under key, or nullptr. Counts a
+  // hit or a miss.
+  std::unique_ptr<EnvModel> take(const ModelCacheKey &key);
+  // Stores an idle model as most recently used and evicts the least
+  // recently used entries beyond the budget.
+  void put(const ModelCacheKey &key, std::unique_ptr<EnvModel> model);
+  void clear();
+  size_t get_size() { return _size; }
+  int get_hits() { return _hits; }
+  int get_misses() { return _misses; }
+
+ private:
+  struct Entry {
+    ModelCacheKey key;
+    std::unique_ptr<EnvModel> model;
+    const void *weights = nullptr;  // EnvModel::get_weights_id
+    size_t cost = 0;                // Charged once per weights
+  };
+  bool holds_weights(const void *weights) const;
+  std::list<Entry>::iterator erase(std::list<Entry>::iterator it);
+  void evict(size_t budget);
+
+  std::list<Entry> _entries;  // Front is most recently used
+  size_t _budget = 32 * 1024 * 1024;
+  size_t _size = 0;
+  std::atomic<int> _hits{0};
+  std::atomic<int> _misses{0};
+};
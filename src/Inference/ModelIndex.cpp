@@ -0,0 +1,237 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: ModelIndex.cpp
+Implements the persistent model metadata index.
+*/
+
+#include "ModelIndex.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "FlatModel.hpp"
+#include "NativeInference.hpp"
+#include "TorchScriptArchive.hpp"
+#include "WeightRegistry.hpp"
+
+namespace {
+
+const char *kIndexHeader = "BesselsTrick model index 1";
+
+// FNV-1a 64 of a whole file, 0 if it can not be read.
+uint64_t hash_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) return 0;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  char buffer[64 * 1024];
+  while (in) {
+    in.read(buffer, sizeof(buffer));
+    const std::streamsize n = in.gcount();
+    for (std::streamsize i = 0; i < n; i++) {
+      hash ^= (uint8_t)buffer[i];
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+uint64_t file_size(const std::string &path) {
+  std::error_code error;
+  const auto size = std::filesystem::file_size(path, error);
+  return error ? 0 : (uint64_t)size;
+}
+
+std::string to_hex(const uint8_t *data, size_t size) {
+  static const char *digits = "0123456789abcdef";
+  std::string hex(size * 2, '0');
+  for (size_t i = 0; i < size; i++) {
+    hex[2 * i] = digits[data[i] >> 4];
+    hex[2 * i + 1] = digits[data[i] & 15];
+  }
+  return hex;
+}
+
+bool from_hex(const std::string &hex, uint8_t *data, size_t size) {
+  if (hex.size() != size * 2) return false;
+  for (size_t i = 0; i < size; i++) {
+    unsigned int byte;
+    if (std::sscanf(hex.c_str() + 2 * i, "%2x", &byte) != 1) return false;
+    data[i] = (uint8_t)byte;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ModelIndex::load(const std::string &index_path) {
+  _path = index_path;
+  _entries.clear();
+  std::ifstream in(index_path);
+  std::string line;
+  if (!in.is_open() || !std::getline(in, line) || line != kIndexHeader)
+    return false;
+  // One model per line, tab separated: the first field is the file name.
+  while (std::getline(in, line)) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t')) fields.push_back(field);
+    if (fields.size() != 10) continue;
+    ModelIndexEntry entry;
+    try {
+      entry.mtime = std::stoll(fields[1]);
+      entry.file_size = std::stoull(fields[2]);
+      entry.content_hash = std::stoull(fields[3], nullptr, 16);
+      entry.n_state = std::stoi(fields[4]);
+      entry.n_inputs = std::stoi(fields[5]);
+      entry.n_outputs = std::stoi(fields[6]);
+      entry.contains_patch = fields[7] == "1";
+      entry.algorithm = std::stoi(fields[8]);
+    } catch (const std::exception &) {
+      continue;
+    }
+    if (entry.contains_patch &&
+        !from_hex(fields[9], entry.patch.data(), entry.patch.size()))
+      continue;
+    _entries[fields[0]] = entry;
+  }
+  return true;
+}
+
+int ModelIndex::update(const std::string &dir,
+                       const std::vector<std::string> &filenames) {
+  int changes = 0;
+  std::set<std::string> listed;
+  for (const auto &filename : filenames) {
+    listed.insert(filename);
+    const std::string path = dir + "/" + filename;
+    auto it = _entries.find(filename);
+    const int64_t mtime = model_file_mtime(path);
+    const uint64_t size = file_size(path);
+    if (it != _entries.end() && it->second.mtime == mtime &&
+        it->second.file_size == size)
+      continue;
+    changes++;
+    // Same contents under a new modification time: keep the metadata.
+    if (it != _entries.end() && it->second.file_size == size &&
+        it->second.content_hash == hash_file(path)) {
+      it->second.mtime = mtime;
+      continue;
+    }
+    ModelIndexEntry entry;
+    probe(path, entry);
+    _entries[filename] = entry;
+  }
+  for (auto it = _entries.begin(); it != _entries.end();) {
+    if (listed.count(it->first)) {
+      ++it;
+      continue;
+    }
+    it = _entries.erase(it);
+    changes++;
+  }
+  return changes;
+}
+
+bool ModelIndex::save() const {
+  if (_path.empty()) return false;
+  // Written aside and renamed, so a reader never sees half an index.
+  const std::string tmp_path = _path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::trunc);
+    if (!out.is_open()) return false;
+    out << kIndexHeader << '\n';
+    for (const auto &item : _entries) {
+      const ModelIndexEntry &entry = item.second;
+      out << item.first << '\t' << entry.mtime << '\t' << entry.file_size
+          << '\t' << std::hex << entry.content_hash << std::dec << '\t'
+          << entry.n_state << '\t' << entry.n_inputs << '\t'
+          << entry.n_outputs << '\t' << (entry.contains_patch ? 1 : 0)
+          << '\t' << entry.algorithm << '\t'
+          << (entry.contains_patch
+                  ? to_hex(entry.patch.data(), entry.patch.size())
+                  : "-")
+          << '\n';
+    }
+    if (!out.good()) return false;
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_path, _path, error);
+  return !error;
+}
+
+const ModelIndexEntry *ModelIndex::find(const std::string &filename) const {
+  auto it = _entries.find(filename);
+  return (it == _entries.end()) ? nullptr : &it->second;
+}
+
+bool ModelIndex::probe(const std::string &path, ModelIndexEntry &entry) {
+  entry = ModelIndexEntry();
+  entry.mtime = model_file_mtime(path);
+  entry.file_size = file_size(path);
+  entry.content_hash = hash_file(path);
+  bool probed = false;
+  if (is_flat_model_file(path)) {
+    FlatModelFile file;
+    if (file.open(path)) {
+      const FlatModelHeader *header = file.header();
+      entry.n_state = (int)header->hidden;
+      entry.n_outputs = (int)header->n_outputs;
+      entry.contains_patch = header->has_patch != 0;
+      std::copy(header->patch, header->patch + 156, entry.patch.begin());
+      probed = true;
+    }
+  } else {
+    // Reads the weights without libtorch, the model is not created.
+    NativeGRUWeights weights;
+    if (load_native_weights(path, 6, weights) && !weights.post.empty()) {
+      entry.n_state = weights.hidden;
+      entry.n_outputs = weights.post.back().out_features;
+      probed = true;
+    }
+    TorchScriptArchive archive;
+    entry.contains_patch = archive.open(path) && archive.get_patch(entry.patch);
+  }
+  if (entry.contains_patch) entry.algorithm = entry.patch[134] + 1;
+  std::cout << "[MODEL INDEX] Probed " << path << ": state " << entry.n_state
+            << (probed ? "" : " (unknown)") << std::endl;
+  return probed;
+}
@@ -0,0 +1,89 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: ModelIndex.hpp
+Persistent index of the models in a directory.
+
+Listing a directory only needs the shape of each model (GRU state size,
+inputs, outputs) and its embedded DX7 patch, but reading them from a
+TorchScript archive means parsing it. The index keeps that metadata in a
+text file, keyed by file name, so a model is only probed when it is new or
+has changed. An entry is stale when the size or modification time of its
+file differ; the content hash then decides whether it must be probed again
+(a copied or touched file keeps its metadata).
+
+Not thread safe, used from the message thread.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+struct ModelIndexEntry {
+  int64_t mtime = 0;
+  uint64_t file_size = 0;
+  uint64_t content_hash = 0;  // FNV-1a 64 of the file
+  int n_state = 0;            // GRU hidden size, 0 if the probe failed
+  int n_inputs = 2;
+  int n_outputs = 6;
+  bool contains_patch = false;
+  int algorithm = 0;          // DX7 algorithm of the patch (1-32), 0 = none
+  std::array<uint8_t, 156> patch = {0};
+};
+
+class ModelIndex {
+ public:
+  // Reads the index stored at index_path. A missing or unreadable file
+  // leaves the index empty. Returns false in that case.
+  bool load(const std::string &index_path);
+  // Brings the entries of dir up to date with filenames, probing the new
+  // and changed ones, and drops the entries of removed files. Returns the
+  // number of entries added, refreshed or dropped.
+  int update(const std::string &dir, const std::vector<std::string> &filenames);
+  // Writes the index back to the path it was loaded from.
+  bool save() const;
+  // nullptr if filename is not indexed.
+  const ModelIndexEntry *find(const std::string &filename) const;
+  // Reads the metadata of a model file without creating the model.
+  static bool probe(const std::string &path, ModelIndexEntry &entry);
+
+ private:
+  std::string _path;
+  std::map<std::string, ModelIndexEntry> _entries;  // By file name
+};
@@ -0,0 +1,293 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: ModelLoader.cpp
+*/
+
+#include "ModelLoader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "BuiltinBank.hpp"
+
+std::unique_ptr<EnvModel> create_env_model(const std::string &path,
+                                           bool prefer_native,
+                                           const BackendOptions &options) {
+  // Preferred backend first: native, unless prefer_native is off.
+  std::vector<const InferenceBackend *> order;
+  for (const auto &backend : inference_backends()) order.push_back(&backend);
+  if (!prefer_native) std::reverse(order.begin(), order.end());
+  for (const InferenceBackend *backend : order) {
+    if (!backend->reads(path)) continue;
+    if (auto model = backend->create(path, options)) return model;
+  }
+  std::cerr << "[MODEL LOADER] No backend in this build can run " << path
+            << std::endl;
+  return nullptr;
+}
+
+ModelLoader::ModelLoader() {}
+
+ModelLoader::~ModelLoader() { stop(); }
+
+void ModelLoader::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _cv.notify_one();
+  std::lock_guard<std::mutex> lock(_worker_mutex);
+  if (_worker.joinable()) _worker.join();
+  collect_retired();
+  delete _pending.exchange(nullptr);
+  _cache.clear();
+}
+
+// Starts the worker on first use. Callers hold no lock.
+void ModelLoader::start_worker() {
+  std::lock_guard<std::mutex> lock(_worker_mutex);
+  if (_worker.joinable()) return;
+  {
+    std::lock_guard<std::mutex> state(_mutex);
+    if (_quit) return;
+  }
+  _worker = std::thread([this] { run(); });
+}
+
+void ModelLoader::request(const ModelRequest &req) {
+  start_worker();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _request = req;
+    _hasRequest = true;
+    _busy = true;
+  }
+  _cv.notify_one();
+}
+
+void ModelLoader::set_max_frames(int max_frames) {
+  _max_frames = std::max(max_frames, 1);
+}
+
+void ModelLoader::set_warmup_steps(int steps) { _warmup_steps = steps; }
+
+void ModelLoader::prefetch(const std::vector<ModelRequest> &requests) {
+  if (!requests.empty()) start_worker();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _prefetch = requests;
+  }
+  _cv.notify_one();
+}
+
+void ModelLoader::set_cache_budget(size_t bytes) { _cache_budget = bytes; }
+
+int ModelLoader::get_cache_hits() { return _cache.get_hits(); }
+
+int ModelLoader::get_cache_misses() { return _cache.get_misses(); }
+
+bool ModelLoader::is_loading() { return _busy; }
+
+EnvModel *ModelLoader::take_pending() {
+  // Cheap check first, processBlock calls this every block.
+  if (_pending.load(std::memory_order_relaxed) == nullptr) return nullptr;
+  return _pending.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+bool ModelLoader::can_retire() {
+  return _retire_head.load(std::memory_order_relaxed) -
+             _retire_tail.load(std::memory_order_acquire) <
+         kRetireSlots;
+}
+
+bool ModelLoader::retire(EnvModel *model) {
+  if (model == nullptr) return true;
+  if (!can_retire()) return false;
+  const size_t head = _retire_head.load(std::memory_order_relaxed);
+  _retired[head % kRetireSlots] = model;
+  _retire_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void ModelLoader::collect_retired() {
+  size_t tail = _retire_tail.load(std::memory_order_relaxed);
+  while (tail != _retire_head.load(std::memory_order_acquire)) {
+    release(_retired[tail % kRetireSlots]);
+    _retired[tail % kRetireSlots] = nullptr;
+    tail++;
+    _retire_tail.store(tail, std::memory_order_release);
+  }
+}
+
+/* Moves a model that left the audio thread into the cache. */
+void ModelLoader::release(EnvModel *model) {
+  auto it = _issued.find(model);
+  if (it == _issued.end()) {
+    delete model;
+    return;
+  }
+  ModelCacheKey key = it->second;
+  _issued.erase(it);
+  _cache.put(key, std::unique_ptr<EnvModel>(model));
+}
+
+std::unique_ptr<EnvModel> ModelLoader::load(const ModelRequest &req) {
+  BackendOptions options;
+  options.n_state = req.n_state;
+  options.torch_optimization = req.torch_optimization;
+  options.torch_executor = req.torch_executor;
+  options.thread_policy = req.thread_policy;
+  auto model = create_env_model(req.path, req.prefer_native, options);
+  // Built-in weights are in the binary and their kernels need no profiling.
+  if (model && !is_builtin_model(req.path)) warm_up(*model);
+  return model;
+}
+
+/* Loads one model into the cache, unless it is cached or playing already. */
+void ModelLoader::run_prefetch(const ModelRequest &req) {
+  const ModelCacheKey key =
+      ModelCache::make_key(req.path, req.n_state, req.prefer_native);
+  if (key.mtime == 0 || _cache.contains(key)) return;
+  for (const auto &issued : _issued)
+    if (issued.second == key) return;
+  auto model = load(req);
+  if (!model) return;
+  std::cout << "[MODEL CACHE] Prefetched " << req.path << std::endl;
+  _cache.put(key, std::move(model));
+}
+
+/*
+  Plays a short synthetic performance so weights are paged in and, for
+  TorchScript models, the profiling executor has specialized the graph on
+  realistic inputs before the model reaches the audio thread. Notes of 32
+  frames (about 46 ms) step by fifths within three octaves, each with a
+  short attack, a decay and a silent gap, so the model also sees silence.
+*/
+void ModelLoader::warm_up(EnvModel &model) {
+  const auto start = std::chrono::steady_clock::now();
+  const int n_frames = _max_frames;
+  const int n_steps = _warmup_steps;
+  model.prepare_sequence(n_frames);
+  std::vector<float> pitch(n_frames, 0.0f);
+  std::vector<float> loudness(n_frames, 0.0f);
+  std::vector<float> output(n_frames * 6, 0.0f);
+  constexpr int kNoteFrames = 32;
+  for (int step = 0; step < n_steps; step++) {
+    for (int t = 0; t < n_frames; t++) {
+      const int frame = step * n_frames + t;
+      const int pos = frame % kNoteFrames;
+      const int note = 45 + (frame / kNoteFrames * 7) % 36;  // From A2
+      const bool sounding = pos < kNoteFrames - 4;
+      pitch[t] = sounding ? 440.0f * powf(2.0f, (note - 69) / 12.0f) : 0.0f;
+      loudness[t] = sounding ? 2.0f * std::min(1.0f, (pos + 1) / 4.0f) *
+                                   expf(-pos / 12.0f)
+                             : 0.0f;
+    }
+    model.call_sequence(pitch.data(), loudness.data(), n_frames,
+                        output.data());
+  }
+  model.reset_state();
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  std::cout << "[MODEL LOADER] Warmed up " << n_steps << " x " << n_frames
+            << " frames in " << us << " us" << std::endl;
+}
+
+void ModelLoader::run() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_quit) {
+    // Wake up periodically to free retired models.
+    _cv.wait_for(lock, std::chrono::milliseconds(100), [this] {
+      return _quit || _hasRequest || !_prefetch.empty();
+    });
+    collect_retired();
+    _cache.set_budget(_cache_budget);
+    if (_quit) continue;
+    if (!_hasRequest) {
+      // Idle, prefetch one model at a time so requests are not delayed.
+      if (_prefetch.empty()) continue;
+      ModelRequest req = _prefetch.front();
+      _prefetch.erase(_prefetch.begin());
+      lock.unlock();
+      run_prefetch(req);
+      lock.lock();
+      continue;
+    }
+
+    ModelRequest req = _request;
+    _hasRequest = false;
+    lock.unlock();
+
+    const auto start = std::chrono::steady_clock::now();
+    ModelLoadResult result;
+    result.path = req.path;
+    const ModelCacheKey key =
+        ModelCache::make_key(req.path, req.n_state, req.prefer_native);
+    auto model = _cache.take(key);
+    const bool cached = (model != nullptr);
+    if (!cached) model = load(req);
+    if (model) {
+      // Sized for the current block, the cached copy may be older.
+      model->prepare_sequence(_max_frames);
+      result.loaded = true;
+      result.contains_patch = model->contains_patch();
+      if (result.contains_patch) result.patch = model->get_patch();
+      EnvModel *published = model.release();
+      _issued[published] = key;
+      // A model published earlier but never taken by the audio thread is
+      // exclusively ours once swapped out.
+      release(_pending.exchange(published, std::memory_order_acq_rel));
+      const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      std::cout << "[MODEL LOADER] " << (cached ? "Cache hit " : "Loaded ")
+                << req.path << " in " << us << " us (hits "
+                << _cache.get_hits() << ", misses " << _cache.get_misses()
+                << ")" << std::endl;
+    } else {
+      std::cerr << "[MODEL LOADER] Could not load " << req.path << std::endl;
+    }
+
+    lock.lock();
+    if (!_hasRequest) _busy = false;
+    lock.unlock();
+    if (on_loaded) on_loaded(result);
+    lock.lock();
+  }
+}
@@ -0,0 +1,155 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: ModelLoader.hpp
+Loads envelope models on a worker thread and hands them to the audio thread.
+
+The worker thread starts with the first request or prefetch, so an instance
+that never loads a model (a host scanning plugins) never starts it.
+
+The audio thread never waits on the loader: a finished model is published in
+an atomic slot that processBlock picks up with take_pending(), and replaced
+models are handed back through a lock-free queue with retire().
+
+Replaced models are not freed but kept in a ModelCache, together with
+models prefetched while idle, so switching back to a recent model skips
+loading from disk.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EnvModels.hpp"
+#include "ModelCache.hpp"
+
+struct ModelRequest {
+  std::string path;
+  int n_state = 0;
+  bool prefer_native = true;  // Try the native backend before libtorch
+  TorchOptimization torch_optimization =
+      TorchOptimization::FREEZE_AND_OPTIMIZE;  // Graph passes (libtorch only)
+  TorchExecutor torch_executor = TorchExecutor::PROFILING;
+  InferenceThreadPolicy thread_policy;  // Process wide, first load decides
+};
+
+struct ModelLoadResult {
+  std::string path;
+  bool loaded = false;
+  bool contains_patch = false;
+  std::array<uint8_t, 156> patch = {0};
+};
+
+// Creates and initializes the model stored in path with the first backend
+// that can run it (see InferenceBackend.hpp). The native backend is tried
+// first unless prefer_native is off. Returns nullptr if none could.
+std::unique_ptr<EnvModel> create_env_model(const std::string &path,
+                                           bool prefer_native,
+                                           const BackendOptions &options);
+
+class ModelLoader {
+ public:
+  ModelLoader();
+  ~ModelLoader();
+  // Any thread. Queues a load. A queued request that has not started yet is
+  // replaced, so only the last selected model is loaded.
+  void request(const ModelRequest &req);
+  // Sequence length new models are prepared (and warmed up) for.
+  void set_max_frames(int max_frames);
+  // Sequences of synthetic performance run on new models before they are
+  // published.
+  void set_warmup_steps(int steps);
+  // Any thread. Models to load into the cache when no request is pending,
+  // replaces the previous prefetch list.
+  void prefetch(const std::vector<ModelRequest> &requests);
+  void set_cache_budget(size_t bytes);
+  int get_cache_hits();
+  int get_cache_misses();
+  bool is_loading();
+  // Audio thread. Returns the last published model or nullptr. The caller
+  // takes ownership.
+  EnvModel *take_pending();
+  // Audio thread. Queues a model to be deleted by the worker. Returns false
+  // (and keeps nothing) if the queue is full.
+  bool retire(EnvModel *model);
+  bool can_retire();
+  // Joins the worker and frees every model still held by the loader. No
+  // request is served afterwards.
+  void stop();
+
+  // Called on the worker thread after every load, successful or not.
+  std::function<void(const ModelLoadResult &)> on_loaded;
+
+ private:
+  void start_worker();
+  void run();
+  void collect_retired();
+  void warm_up(EnvModel &model);
+  std::unique_ptr<EnvModel> load(const ModelRequest &req);
+  void run_prefetch(const ModelRequest &req);
+  void release(EnvModel *model);
+
+  std::thread _worker;
+  std::mutex _worker_mutex;  // Guards starting and joining _worker
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  ModelRequest _request;
+  bool _hasRequest = false;
+  bool _quit = false;
+  std::vector<ModelRequest> _prefetch;
+  std::atomic<size_t> _cache_budget{32 * 1024 * 1024};
+  std::atomic<bool> _busy{false};
+  std::atomic<int> _max_frames{1};
+  std::atomic<int> _warmup_steps{2};
+
+  std::atomic<EnvModel *> _pending{nullptr};
+  // Single producer (audio) / single consumer (worker) ring.
+  static constexpr size_t kRetireSlots = 8;
+  std::array<EnvModel *, kRetireSlots> _retired = {nullptr};
+  std::atomic<size_t> _retire_head{0};
+  std::atomic<size_t> _retire_tail{0};
+
+  // Worker thread only.
+  ModelCache _cache;
+  std::unordered_map<EnvModel *, ModelCacheKey> _issued;  // Published models
+};
@@ -0,0 +1,774 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: NativeInference.cpp
+Implements weight extraction and SIMD stepping of the envelope RNNs.
+*/
+
+#include "NativeInference.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "BuiltinBank.hpp"
+#include "FlatModel.hpp"
+#include "TorchScriptArchive.hpp"
+#include "WeightRegistry.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define NATIVE_KERNEL_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NATIVE_KERNEL_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define NATIVE_KERNEL_NEON 1
+#endif
+
+namespace {
+
+constexpr size_t kAlignFloats = 16;  // 64 bytes, one cache line.
+
+/*
+  y = W x + b for a row-major W of size [rows x cols].
+  Four rows are accumulated together so every load of x is reused four times
+  and the weights are streamed linearly from memory. A non-zero kCols fixes
+  cols at compile time (see GRUKernel), the sums are the same. W must then
+  be 64-byte aligned, as load_native_weights, FlatModel and BuiltinBank
+  leave every matrix: when kCols is a multiple of the vector width, every
+  row starts on a vector boundary and the weights use aligned loads.
+*/
+template <int kCols = 0>
+inline void matvec(const float *W, const float *b, const float *x, float *y,
+                   int rows, int n_cols) {
+  const int cols = (kCols > 0) ? kCols : n_cols;
+  int r = 0;
+#if defined(NATIVE_KERNEL_AVX2)
+  constexpr bool aligned = kCols > 0 && kCols % 8 == 0;
+  auto load_w = [](const float *w) {
+    return aligned ? _mm256_load_ps(w) : _mm256_loadu_ps(w);
+  };
+  for (; r + 4 <= rows; r += 4) {
+    const float *w0 = W + (size_t)r * cols;
+    const float *w1 = w0 + cols;
+    const float *w2 = w1 + cols;
+    const float *w3 = w2 + cols;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    int c = 0;
+    for (; c + 8 <= cols; c += 8) {
+      const __m256 xv = _mm256_loadu_ps(x + c);
+      acc0 = _mm256_fmadd_ps(load_w(w0 + c), xv, acc0);
+      acc1 = _mm256_fmadd_ps(load_w(w1 + c), xv, acc1);
+      acc2 = _mm256_fmadd_ps(load_w(w2 + c), xv, acc2);
+      acc3 = _mm256_fmadd_ps(load_w(w3 + c), xv, acc3);
+    }
+    // Transpose-reduce the four accumulators into one vector of row sums.
+    const __m256 s01 = _mm256_hadd_ps(acc0, acc1);
+    const __m256 s23 = _mm256_hadd_ps(acc2, acc3);
+    const __m256 s = _mm256_hadd_ps(s01, s23);
+    __m128 sums = _mm_add_ps(_mm256_castps256_ps128(s),
+                             _mm256_extractf128_ps(s, 1));
+    float out[4];
+    _mm_storeu_ps(out, sums);
+    for (; c < cols; c++) {
+      out[0] += w0[c] * x[c];
+      out[1] += w1[c] * x[c];
+      out[2] += w2[c] * x[c];
+      out[3] += w3[c] * x[c];
+    }
+    for (int k = 0; k < 4; k++) y[r + k] = out[k] + (b ? b[r + k] : 0.0f);
+  }
+#elif defined(NATIVE_KERNEL_SSE2)
+  constexpr bool aligned = kCols > 0 && kCols % 4 == 0;
+  auto load_w = [](const float *w) {
+    return aligned ? _mm_load_ps(w) : _mm_loadu_ps(w);
+  };
+  for (; r + 4 <= rows; r += 4) {
+    const float *w0 = W + (size_t)r * cols;
+    const float *w1 = w0 + cols;
+    const float *w2 = w1 + cols;
+    const float *w3 = w2 + cols;
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    int c = 0;
+    for (; c + 4 <= cols; c += 4) {
+      const __m128 xv = _mm_loadu_ps(x + c);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(load_w(w0 + c), xv));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(load_w(w1 + c), xv));
+      acc2 = _mm_add_ps(acc2, _mm_mul_ps(load_w(w2 + c), xv));
+      acc3 = _mm_add_ps(acc3, _mm_mul_ps(load_w(w3 + c), xv));
+    }
+    _MM_TRANSPOSE4_PS(acc0, acc1, acc2, acc3);
+    const __m128 sums =
+        _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+    float out[4];
+    _mm_storeu_ps(out, sums);
+    for (; c < cols; c++) {
+      out[0] += w0[c] * x[c];
+      out[1] += w1[c] * x[c];
+      out[2] += w2[c] * x[c];
+      out[3] += w3[c] * x[c];
+    }
+    for (int k = 0; k < 4; k++) y[r + k] = out[k] + (b ? b[r + k] : 0.0f);
+  }
+#elif defined(NATIVE_KERNEL_NEON)
+  for (; r + 4 <= rows; r += 4) {
+    const float *w0 = W + (size_t)r * cols;
+    const float *w1 = w0 + cols;
+    const float *w2 = w1 + cols;
+    const float *w3 = w2 + cols;
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f), acc3 = vdupq_n_f32(0.0f);
+    int c = 0;
+    for (; c + 4 <= cols; c += 4) {
+      const float32x4_t xv = vld1q_f32(x + c);
+      acc0 = vfmaq_f32(acc0, vld1q_f32(w0 + c), xv);
+      acc1 = vfmaq_f32(acc1, vld1q_f32(w1 + c), xv);
+      acc2 = vfmaq_f32(acc2, vld1q_f32(w2 + c), xv);
+      acc3 = vfmaq_f32(acc3, vld1q_f32(w3 + c), xv);
+    }
+    float out[4] = {vaddvq_f32(acc0), vaddvq_f32(acc1), vaddvq_f32(acc2),
+                    vaddvq_f32(acc3)};
+    for (; c < cols; c++) {
+      out[0] += w0[c] * x[c];
+      out[1] += w1[c] * x[c];
+      out[2] += w2[c] * x[c];
+      out[3] += w3[c] * x[c];
+    }
+    for (int k = 0; k < 4; k++) y[r + k] = out[k] + (b ? b[r + k] : 0.0f);
+  }
+#endif
+  // Scalar reference, also handles the remaining rows.
+  for (; r < rows; r++) {
+    const float *w = W + (size_t)r * cols;
+    float acc = b ? b[r] : 0.0f;
+    for (int c = 0; c < cols; c++) acc += w[c] * x[c];
+    y[r] = acc;
+  }
+}
+
+/*
+  Y[t] = W X[t] + b for n_frames frames. Rows are processed in tiles small
+  enough to stay in L1, so each weight tile is read from memory once for the
+  whole sequence instead of once per frame. kCols is passed on to matvec.
+*/
+template <int kCols = 0>
+void matmat(const float *W, const float *b, const float *X, int x_stride,
+            float *Y, int y_stride, int rows, int cols, int n_frames) {
+  constexpr int kRowTile = 16;
+  for (int r = 0; r < rows; r += kRowTile) {
+    const int n = std::min(kRowTile, rows - r);
+    for (int t = 0; t < n_frames; t++)
+      matvec<kCols>(W + (size_t)r * cols, b ? b + r : nullptr,
+                    X + (size_t)t * x_stride, Y + (size_t)t * y_stride + r,
+                    n, cols);
+  }
+}
+
+inline float sigmoid(float x) { return 1.0f / (1.0f + expf(-x)); }
+
+/*
+  Vector exp, after Cephes expf: x = n ln2 + r with |r| <= ln2 / 2, a degree
+  7 polynomial for exp(r) and n added to the exponent. Within 2 ulp of expf.
+  Inputs are clamped to +-87, where sigmoid and tanh have long saturated.
+*/
+constexpr float kExpLimit = 87.0f;
+constexpr float kExpP[6] = {1.9875691500e-4f, 1.3981999507e-3f,
+                            8.3334519073e-3f, 4.1665795894e-2f,
+                            1.6666665459e-1f, 5.0000001201e-1f};
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+
+#if defined(NATIVE_KERNEL_AVX2)
+inline __m256 exp_ps(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-kExpLimit)),
+                    _mm256_set1_ps(kExpLimit));
+  const __m256i n =
+      _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)));
+  const __m256 fn = _mm256_cvtepi32_ps(n);
+  __m256 r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(kLn2Hi), x);
+  r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(kLn2Lo), r);
+  __m256 p = _mm256_set1_ps(kExpP[0]);
+  for (int k = 1; k < 6; k++)
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP[k]));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r),
+                      _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+  const __m256i e =
+      _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+inline __m256 sigmoid_ps(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  return _mm256_div_ps(
+      one, _mm256_add_ps(one, exp_ps(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+#elif defined(NATIVE_KERNEL_SSE2)
+inline __m128 exp_ps(__m128 x) {
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-kExpLimit)),
+                 _mm_set1_ps(kExpLimit));
+  const __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+  const __m128 fn = _mm_cvtepi32_ps(n);
+  __m128 r = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(kLn2Hi)));
+  r = _mm_sub_ps(r, _mm_mul_ps(fn, _mm_set1_ps(kLn2Lo)));
+  __m128 p = _mm_set1_ps(kExpP[0]);
+  for (int k = 1; k < 6; k++)
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP[k]));
+  p = _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)),
+                 _mm_add_ps(r, _mm_set1_ps(1.0f)));
+  const __m128i e = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+inline __m128 sigmoid_ps(__m128 x) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  return _mm_div_ps(one,
+                    _mm_add_ps(one, exp_ps(_mm_sub_ps(_mm_setzero_ps(), x))));
+}
+#elif defined(NATIVE_KERNEL_NEON)
+inline float32x4_t exp_ps(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-kExpLimit)), vdupq_n_f32(kExpLimit));
+  const int32x4_t n = vcvtnq_s32_f32(vmulq_n_f32(x, 1.44269504f));
+  const float32x4_t fn = vcvtq_f32_s32(n);
+  float32x4_t r = vfmsq_f32(x, fn, vdupq_n_f32(kLn2Hi));
+  r = vfmsq_f32(r, fn, vdupq_n_f32(kLn2Lo));
+  float32x4_t p = vdupq_n_f32(kExpP[0]);
+  for (int k = 1; k < 6; k++) p = vfmaq_f32(vdupq_n_f32(kExpP[k]), p, r);
+  p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+  const int32x4_t e = vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(e));
+}
+inline float32x4_t sigmoid_ps(float32x4_t x) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  return vdivq_f32(one, vaddq_f32(one, exp_ps(vnegq_f32(x))));
+}
+#endif
+
+/*
+  GRU cell, PyTorch gate order (r, z, n). gates_x holds W_ih x + b_ih and
+  gates_h holds W_hh h + b_hh.
+    r = sig(Wir x + bir + Whr h + bhr)
+    z = sig(Wiz x + biz + Whz h + bhz)
+    n = tanh(Win x + bin + r * (Whn h + bhn))
+    h = (1 - z) * n + z * h
+  The sigmoids and tanh (2 sig(2x) - 1) are the bulk of a step: they run on
+  vectors with exp_ps, the scalar loop is the reference and takes the tail.
+*/
+inline void gru_gates(const float *gates_x, const float *gates_h, float *h,
+                      int H) {
+  int i = 0;
+#if defined(NATIVE_KERNEL_AVX2)
+  const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+  for (; i + 8 <= H; i += 8) {
+    const __m256 r = sigmoid_ps(_mm256_add_ps(_mm256_loadu_ps(gates_x + i),
+                                              _mm256_loadu_ps(gates_h + i)));
+    const __m256 z = sigmoid_ps(_mm256_add_ps(
+        _mm256_loadu_ps(gates_x + H + i), _mm256_loadu_ps(gates_h + H + i)));
+    const __m256 a = _mm256_fmadd_ps(r, _mm256_loadu_ps(gates_h + 2 * H + i),
+                                     _mm256_loadu_ps(gates_x + 2 * H + i));
+    const __m256 n =
+        _mm256_fmsub_ps(two, sigmoid_ps(_mm256_mul_ps(two, a)), one);
+    const __m256 zh = _mm256_mul_ps(z, _mm256_loadu_ps(h + i));
+    _mm256_storeu_ps(h + i, _mm256_fmadd_ps(_mm256_sub_ps(one, z), n, zh));
+  }
+#elif defined(NATIVE_KERNEL_SSE2)
+  const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+  for (; i + 4 <= H; i += 4) {
+    const __m128 r = sigmoid_ps(
+        _mm_add_ps(_mm_loadu_ps(gates_x + i), _mm_loadu_ps(gates_h + i)));
+    const __m128 z = sigmoid_ps(_mm_add_ps(_mm_loadu_ps(gates_x + H + i),
+                                           _mm_loadu_ps(gates_h + H + i)));
+    const __m128 a =
+        _mm_add_ps(_mm_loadu_ps(gates_x + 2 * H + i),
+                   _mm_mul_ps(r, _mm_loadu_ps(gates_h + 2 * H + i)));
+    const __m128 n =
+        _mm_sub_ps(_mm_mul_ps(two, sigmoid_ps(_mm_mul_ps(two, a))), one);
+    _mm_storeu_ps(h + i, _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, z), n),
+                                    _mm_mul_ps(z, _mm_loadu_ps(h + i))));
+  }
+#elif defined(NATIVE_KERNEL_NEON)
+  const float32x4_t one = vdupq_n_f32(1.0f), two = vdupq_n_f32(2.0f);
+  for (; i + 4 <= H; i += 4) {
+    const float32x4_t r = sigmoid_ps(
+        vaddq_f32(vld1q_f32(gates_x + i), vld1q_f32(gates_h + i)));
+    const float32x4_t z = sigmoid_ps(
+        vaddq_f32(vld1q_f32(gates_x + H + i), vld1q_f32(gates_h + H + i)));
+    const float32x4_t a = vfmaq_f32(vld1q_f32(gates_x + 2 * H + i), r,
+                                    vld1q_f32(gates_h + 2 * H + i));
+    const float32x4_t n =
+        vsubq_f32(vmulq_f32(two, sigmoid_ps(vmulq_f32(two, a))), one);
+    vst1q_f32(h + i, vfmaq_f32(vmulq_f32(z, vld1q_f32(h + i)),
+                               vsubq_f32(one, z), n));
+  }
+#endif
+  for (; i < H; i++) {
+    const float r = sigmoid(gates_x[i] + gates_h[i]);
+    const float z = sigmoid(gates_x[H + i] + gates_h[H + i]);
+    const float n = tanhf(gates_x[2 * H + i] + r * gates_h[2 * H + i]);
+    h[i] = (1.0f - z) * n + z * h[i];
+  }
+}
+
+/*
+  GRU kernels with every size fixed at compile time, so the loops of matvec
+  and gru_gates are fully unrolled, need no tails and load the weights
+  aligned. In is the GRU input width and Out the rows of the output layer,
+  fused when it is the only one (0 otherwise). The input projection and the
+  output layer run over whole sequences, tiled like matmat. Sums are taken
+  in the same order as the generic kernels, so results only differ where
+  the compiler contracts the unrolled tails into FMAs differently (float
+  rounding).
+*/
+template <int Hidden, int In, int Out>
+struct GRUKernel {
+  static void input(const NativeGRUWeights &w, const float *x, int x_stride,
+                    float *gates_x, int n_frames) {
+    matmat<In>(w.w_ih, w.b_ih, x, x_stride, gates_x, 3 * Hidden, 3 * Hidden,
+               In, n_frames);
+  }
+  static void recur(const NativeGRUWeights &w, const float *gates_x,
+                    float *gates_h, float *h) {
+    matvec<Hidden>(w.w_hh, w.b_hh, h, gates_h, 3 * Hidden, Hidden);
+    gru_gates(gates_x, gates_h, h, Hidden);
+  }
+  static void output(const NativeGRUWeights &w, const float *h, float *y,
+                     int y_stride, int n_frames) {
+    matmat<Hidden>(w.post[0].weight, w.post[0].bias, h, Hidden, y, y_stride,
+                   Out, Hidden, n_frames);
+  }
+  static constexpr GRUKernelOps ops = {&input, &recur,
+                                       Out > 0 ? &output : nullptr};
+};
+
+template <int Hidden>
+const GRUKernelOps *select_gru_kernel_for(const NativeGRUWeights &weights,
+                                          int n_outputs) {
+  const bool fuse_output = weights.post.size() == 1 && n_outputs == 6 &&
+                           weights.post[0].out_features == 6 &&
+                           !weights.post[0].relu;
+  if (weights.gru_input == 2)
+    return fuse_output ? &GRUKernel<Hidden, 2, 6>::ops
+                       : &GRUKernel<Hidden, 2, 0>::ops;
+  if (weights.gru_input == Hidden)
+    return fuse_output ? &GRUKernel<Hidden, Hidden, 6>::ops
+                       : &GRUKernel<Hidden, Hidden, 0>::ops;
+  return nullptr;
+}
+
+/*
+  Runs an MLP over n_rows rows, ping-ponging between buf_a and buf_b (rows of
+  stride floats). Returns the output rows and updates x_stride to match.
+*/
+const float *mlp_rows(const std::vector<NativeLinear> &layers, const float *x,
+                      int &x_stride, int n_rows, float *buf_a, float *buf_b,
+                      int stride) {
+  float *dst = buf_a;
+  for (const auto &layer : layers) {
+    matmat(layer.weight, layer.bias, x, x_stride, dst, stride,
+           layer.out_features, layer.in_features, n_rows);
+    if (layer.relu)
+      for (int t = 0; t < n_rows; t++) {
+        float *row = dst + (size_t)t * stride;
+        for (int i = 0; i < layer.out_features; i++)
+          row[i] = std::max(row[i], 0.0f);
+      }
+    x = dst;
+    x_stride = stride;
+    dst = (dst == buf_a) ? buf_b : buf_a;
+  }
+  return x;
+}
+
+// Widest activation of the model, the row stride of the MLP buffers.
+int widest_layer(const NativeGRUWeights &weights) {
+  int widest = std::max(weights.hidden, 2);
+  for (const auto &layer : weights.pre)
+    widest = std::max(widest, layer.out_features);
+  for (const auto &layer : weights.post)
+    widest = std::max(widest, layer.out_features);
+  return widest;
+}
+
+/* Fetches a float tensor from the archive, checking its shape. */
+const float *fetch_tensor(const TorchScriptArchive &archive,
+                          const PickleValuePtr &tensor,
+                          std::vector<int64_t> &shape) {
+  if (!tensor || tensor->kind != PickleValue::TENSOR ||
+      tensor->dtype != "FloatStorage")
+    return nullptr;
+  size_t nbytes;
+  const uint8_t *data = archive.get_tensor_data(*tensor, nbytes);
+  shape = tensor->shape;
+  return (const float *)data;
+}
+
+struct TensorView {
+  const float *data = nullptr;
+  size_t numel = 0;
+};
+
+bool is_linear_context(const PickleValuePtr &value) {
+  return value->kind == PickleValue::OBJECT &&
+         value->str.find("LinearOpContext") != std::string::npos &&
+         !value->items.empty() &&
+         value->items.back()->kind == PickleValue::TUPLE;
+}
+
+}  // namespace
+
+/*
+  Constants are serialized in order of first use in forward(), so the layout
+  is: LinearOpContexts of the input MLP, the four GRU tensors
+  (w_ih, w_hh, b_ih, b_hh), then the LinearOpContexts of the output MLP.
+  The exported MLPs apply ReLU between layers, not after the last one.
+*/
+bool load_native_weights(const std::string &filename, int n_outputs,
+                         NativeGRUWeights &weights) {
+  TorchScriptArchive archive;
+  if (!archive.open(filename)) return false;
+  auto constants = archive.unpickle("constants.pkl");
+  if (!constants || constants->kind != PickleValue::TUPLE) {
+    std::cerr << "[NATIVE MODEL] No constants found in " << filename
+              << std::endl;
+    return false;
+  }
+
+  weights = NativeGRUWeights();
+  std::vector<TensorView> views;
+  int n_gru_tensors = 0;
+  std::vector<int64_t> shape;
+
+  // Layers are collected with null pointers, fixed up after the copy.
+  for (const auto &value : constants->items) {
+    if (is_linear_context(value)) {
+      if (n_gru_tensors != 0 && n_gru_tensors != 4) return false;
+      const auto &ctx = value->items.back()->items;
+      NativeLinear layer;
+      const float *w = fetch_tensor(archive, ctx[0], shape);
+      if (!w || shape.size() != 2) return false;
+      layer.out_features = (int)shape[0];
+      layer.in_features = (int)shape[1];
+      auto &block = (n_gru_tensors == 0) ? weights.pre : weights.post;
+      block.push_back(layer);
+      views.push_back({w, (size_t)(shape[0] * shape[1])});
+      if (ctx.size() > 1 && ctx[1]->kind == PickleValue::TENSOR) {
+        const float *b = fetch_tensor(archive, ctx[1], shape);
+        if (!b || shape.size() != 1 || shape[0] != layer.out_features)
+          return false;
+        views.push_back({b, (size_t)shape[0]});
+      } else {
+        views.push_back({nullptr, 0});
+      }
+    } else if (value->kind == PickleValue::TENSOR) {
+      if (n_gru_tensors >= 4) return false;
+      const float *t = fetch_tensor(archive, value, shape);
+      if (!t) return false;
+      size_t numel = 1;
+      for (int64_t dim : shape) numel *= dim;
+      if (n_gru_tensors == 0) {
+        if (shape.size() != 2 || shape[0] % 3 != 0) return false;
+        weights.hidden = (int)shape[0] / 3;
+        weights.gru_input = (int)shape[1];
+      }
+      views.push_back({t, numel});
+      n_gru_tensors++;
+    } else {
+      std::cerr << "[NATIVE MODEL] Unsupported constant " << value->str
+                << std::endl;
+      return false;
+    }
+  }
+  const int H = weights.hidden;
+  if (n_gru_tensors != 4 || weights.post.empty()) return false;
+
+  // Copy into one buffer, each tensor starting on a cache line.
+  size_t total = 0;
+  for (const auto &view : views)
+    total += (view.numel + kAlignFloats - 1) / kAlignFloats * kAlignFloats;
+  weights.storage.assign(total + kAlignFloats, 0.0f);
+  float *base = weights.storage.data();
+  while (((uintptr_t)base) % (kAlignFloats * sizeof(float)) != 0) base++;
+
+  std::vector<const float *> copies;
+  for (const auto &view : views) {
+    if (view.data == nullptr) {
+      copies.push_back(nullptr);
+      continue;
+    }
+    std::memcpy(base, view.data, view.numel * sizeof(float));
+    copies.push_back(base);
+    base += (view.numel + kAlignFloats - 1) / kAlignFloats * kAlignFloats;
+  }
+
+  // Wire views: [pre w,b]* [w_ih w_hh b_ih b_hh] [post w,b]*
+  size_t idx = 0;
+  for (auto &layer : weights.pre) {
+    layer.weight = copies[idx++];
+    layer.bias = copies[idx++];
+  }
+  weights.w_ih = copies[idx++];
+  weights.w_hh = copies[idx++];
+  weights.b_ih = copies[idx++];
+  weights.b_hh = copies[idx++];
+  for (auto &layer : weights.post) {
+    layer.weight = copies[idx++];
+    layer.bias = copies[idx++];
+  }
+  for (size_t l = 0; l + 1 < weights.pre.size(); l++) weights.pre[l].relu = true;
+  for (size_t l = 0; l + 1 < weights.post.size(); l++) weights.post[l].relu = true;
+
+  const size_t expected[4] = {(size_t)3 * H * weights.gru_input,
+                              (size_t)3 * H * H, (size_t)3 * H,
+                              (size_t)3 * H};
+  for (int t = 0; t < 4; t++)
+    if (views[2 * weights.pre.size() + t].numel != expected[t]) return false;
+  return validate_native_weights(weights, n_outputs);
+}
+
+bool validate_native_weights(const NativeGRUWeights &weights, int n_outputs) {
+  int features = 2;
+  for (const auto &layer : weights.pre) {
+    if (layer.in_features != features) return false;
+    features = layer.out_features;
+  }
+  if (features != weights.gru_input || weights.hidden <= 0) return false;
+  features = weights.hidden;
+  for (const auto &layer : weights.post) {
+    if (layer.in_features != features) return false;
+    features = layer.out_features;
+  }
+  return !weights.post.empty() && features == n_outputs;
+}
+
+size_t native_weights_size(const NativeGRUWeights &weights) {
+  auto matrix = [](const float *b, int rows, int cols) {
+    return (size_t)rows * cols * sizeof(float) + (b ? rows * sizeof(float) : 0);
+  };
+  const int H = weights.hidden;
+  size_t bytes = matrix(weights.b_ih, 3 * H, weights.gru_input) +
+                 matrix(weights.b_hh, 3 * H, H);
+  for (const auto *layers : {&weights.pre, &weights.post})
+    for (const auto &layer : *layers)
+      bytes += matrix(layer.bias, layer.out_features, layer.in_features);
+  return bytes;
+}
+
+const GRUKernelOps *select_gru_kernel(const NativeGRUWeights &weights,
+                                      int n_outputs) {
+  switch (weights.hidden) {
+    case 32: return select_gru_kernel_for<32>(weights, n_outputs);
+    case 64: return select_gru_kernel_for<64>(weights, n_outputs);
+    case 128: return select_gru_kernel_for<128>(weights, n_outputs);
+    case 256: return select_gru_kernel_for<256>(weights, n_outputs);
+    default: return nullptr;
+  }
+}
+
+NativeGRU::NativeGRU() {}
+
+bool NativeGRU::init(const std::string &filename, int n_outputs) {
+  auto load = [&]() -> std::shared_ptr<NativeModelData> {
+    // Loaded in place, the weight views point into data->weights.storage.
+    auto data = std::make_shared<NativeModelData>();
+    if (const BuiltinModel *builtin = find_builtin_model(filename)) {
+      // The weights stay in the binary, data->size is 0.
+      load_builtin_weights(*builtin, data->weights, data->patch,
+                           data->contains_patch);
+      return data;
+    }
+    bool loaded = true;
+    if (is_flat_model_file(filename)) {
+      loaded = load_flat_weights(filename, data->weights, data->patch,
+                                 data->contains_patch);
+    } else {
+      TorchScriptArchive archive;
+      loaded = load_native_weights(filename, n_outputs, data->weights);
+      data->contains_patch =
+          loaded && archive.open(filename) && archive.get_patch(data->patch);
+    }
+    if (!loaded) return nullptr;
+    data->size = native_weights_size(data->weights);
+    return data;
+  };
+  _data = WeightRegistry<NativeModelData>::instance().acquire(filename, load);
+  if (!_data || !validate_native_weights(_data->weights, n_outputs)) {
+    std::cerr << "[NATIVE MODEL] Unsupported model " << filename << std::endl;
+    _data.reset();
+    return false;
+  }
+  _weights = &_data->weights;
+  _n_outputs = n_outputs;
+  _kernel = select_gru_kernel(*_weights, n_outputs);
+  const int H = _weights->hidden;
+  _gates_x.assign(3 * H, 0.0f);
+  _gates_h.assign(3 * H, 0.0f);
+  const int widest = widest_layer(*_weights);
+  _mlp_a.assign(widest, 0.0f);
+  _mlp_b.assign(widest, 0.0f);
+  _seq_stride = widest;
+  _max_frames = 0;
+  prepare_sequence(1);
+
+  const std::string base_filename =
+      filename.substr(filename.find_last_of("/\\") + 1);
+  std::cout << "[NATIVE MODEL] " << base_filename << " loaded!\n"
+            << "\tInput MLP: " << _weights->pre.size() << " layers\n"
+            << "\tGRU: " << _weights->gru_input << " -> " << H
+            << (_kernel ? " (fixed-size kernel)\n" : "\n")
+            << "\tOutput MLP: " << _weights->post.size() << " layers\n"
+            << "\tWeights: " << native_weights_size(*_weights) << " bytes\n";
+  return true;
+}
+
+bool NativeGRU::contains_patch() { return _data && _data->contains_patch; }
+
+void NativeGRU::get_patch(std::array<uint8_t, 156> &dest) {
+  if (_data) dest = _data->patch;
+}
+
+int NativeGRU::get_state_len() { return _weights ? _weights->hidden : 0; }
+
+/* One recurrent step, gates_x holds W_ih x + b_ih. */
+void NativeGRU::gru_update(const float *gates_x, float *h) {
+  if (_kernel) {
+    _kernel->recur(*_weights, gates_x, _gates_h.data(), h);
+    return;
+  }
+  const int H = _weights->hidden;
+  matvec(_weights->w_hh, _weights->b_hh, h, _gates_h.data(), 3 * H, H);
+  gru_gates(gates_x, _gates_h.data(), h, H);
+}
+
+void NativeGRU::call(std::array<float, 2> input_array,
+                     std::vector<float> &output_array,
+                     std::vector<float> &state_array) {
+  const int H = _weights->hidden;
+  float *h = state_array.data();
+
+  // Input MLP
+  const float *x = input_array.data();
+  float *dst = _mlp_a.data();
+  for (const auto &layer : _weights->pre) {
+    matvec(layer.weight, layer.bias, x, dst, layer.out_features,
+           layer.in_features);
+    if (layer.relu)
+      for (int i = 0; i < layer.out_features; i++)
+        dst[i] = std::max(dst[i], 0.0f);
+    x = dst;
+    dst = (dst == _mlp_a.data()) ? _mlp_b.data() : _mlp_a.data();
+  }
+
+  if (_kernel)
+    _kernel->input(*_weights, x, _weights->gru_input, _gates_x.data(), 1);
+  else
+    matvec(_weights->w_ih, _weights->b_ih, x, _gates_x.data(), 3 * H,
+           _weights->gru_input);
+  gru_update(_gates_x.data(), h);
+
+  if (_kernel && _kernel->output) {
+    _kernel->output(*_weights, h, _mlp_a.data(), _n_outputs, 1);
+    for (int i = 0; i < _n_outputs; i++)
+      output_array[i] = _mlp_a[i] * _weights->output_scale;
+    return;
+  }
+
+  // Output MLP
+  x = h;
+  dst = _mlp_a.data();
+  for (const auto &layer : _weights->post) {
+    matvec(layer.weight, layer.bias, x, dst, layer.out_features,
+           layer.in_features);
+    if (layer.relu)
+      for (int i = 0; i < layer.out_features; i++)
+        dst[i] = std::max(dst[i], 0.0f);
+    x = dst;
+    dst = (dst == _mlp_a.data()) ? _mlp_b.data() : _mlp_a.data();
+  }
+  for (int i = 0; i < _n_outputs; i++)
+    output_array[i] = x[i] * _weights->output_scale;
+}
+
+void NativeGRU::prepare_sequence(int max_frames) {
+  if (max_frames <= _max_frames) return;
+  _max_frames = max_frames;
+  const int H = _weights->hidden;
+  _seq_a.assign((size_t)_max_frames * _seq_stride, 0.0f);
+  _seq_b.assign((size_t)_max_frames * _seq_stride, 0.0f);
+  _seq_gates_x.assign((size_t)_max_frames * 3 * H, 0.0f);
+  _seq_h.assign((size_t)_max_frames * H, 0.0f);
+}
+
+void NativeGRU::call_sequence(const float *input_array, int n_frames,
+                              float *output_array,
+                              std::vector<float> &state_array) {
+  if (n_frames <= 0) return;
+  if (n_frames > _max_frames) prepare_sequence(n_frames);  // Not expected
+  const int H = _weights->hidden;
+  float *h = state_array.data();
+
+  // Input MLP and input projection of the GRU, batched over frames.
+  int x_stride = 2;
+  const float *x = mlp_rows(_weights->pre, input_array, x_stride, n_frames,
+                            _seq_a.data(), _seq_b.data(), _seq_stride);
+  if (_kernel)
+    _kernel->input(*_weights, x, x_stride, _seq_gates_x.data(), n_frames);
+  else
+    matmat(_weights->w_ih, _weights->b_ih, x, x_stride, _seq_gates_x.data(),
+           3 * H, 3 * H, _weights->gru_input, n_frames);
+
+  // Recurrence
+  for (int t = 0; t < n_frames; t++) {
+    gru_update(_seq_gates_x.data() + (size_t)t * 3 * H, h);
+    std::copy(h, h + H, _seq_h.data() + (size_t)t * H);
+  }
+
+  // Output MLP, batched over frames.
+  x_stride = H;
+  if (_kernel && _kernel->output) {
+    _kernel->output(*_weights, _seq_h.data(), _seq_a.data(), _seq_stride,
+                    n_frames);
+    x = _seq_a.data();
+    x_stride = _seq_stride;
+  } else {
+    x = mlp_rows(_weights->post, _seq_h.data(), x_stride, n_frames,
+                 _seq_a.data(), _seq_b.data(), _seq_stride);
+  }
+  for (int t = 0; t < n_frames; t++)
+    for (int i = 0; i < _n_outputs; i++)
+      output_array[t * _n_outputs + i] =
+          x[(size_t)t * x_stride + i] * _weights->output_scale;
+}
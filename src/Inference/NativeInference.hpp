@@ -0,0 +1,161 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: NativeInference.hpp
+libtorch-free inference of the envelope RNNs.
+
+Weights are extracted once from the TorchScript archive (or mapped from a
+flat .btm file, see FlatModel.hpp) and the model is
+stepped with hand-written SIMD kernels for the matrix-vector products and the
+gate activations (AVX2/FMA, SSE2 or NEON, with a scalar fallback). Supported graphs are the ones exported by the
+Envelope Learning pipeline:
+
+    [Linear -> ReLU]* Linear -> GRU -> [Linear -> ReLU]* Linear -> x2
+
+where both MLPs are optional. The output matches libtorch within 1e-4
+(absolute, on the output levels) for every model in resources/pretrained.
+
+Weights stay float. int8 weights with 16-bit activations were tried: steps
+were no faster, since widening the weights costs as much as a float FMA, and
+only half the pretrained models stayed within 0.05 of the float envelopes.
+With 8-bit activations (maddubs) products ran 1.6 times faster, but only 4
+of the 46 models stayed within that tolerance.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct NativeLinear {
+  int in_features = 0;
+  int out_features = 0;
+  const float *weight = nullptr;  // [out_features x in_features], row major
+  const float *bias = nullptr;    // [out_features] or nullptr
+  bool relu = false;              // Apply ReLU after this layer
+};
+
+struct NativeGRUWeights {
+  std::vector<NativeLinear> pre;   // Input MLP, may be empty.
+  int gru_input = 0;
+  int hidden = 0;
+  const float *w_ih = nullptr;     // [3*hidden x gru_input], gates r,z,n
+  const float *w_hh = nullptr;     // [3*hidden x hidden]
+  const float *b_ih = nullptr;     // [3*hidden]
+  const float *b_hh = nullptr;     // [3*hidden]
+  std::vector<NativeLinear> post;  // Output MLP, at least one layer.
+  float output_scale = 2.0f;       // ScriptWrapper denormalization (OL max)
+  std::vector<float> storage;      // Owns the weights views point into,
+  std::shared_ptr<void> mapping;   // or keeps a mapped .btm file alive.
+};
+
+// Immutable model data. Instances loading the same file share one copy
+// through WeightRegistry, each NativeGRU only owns its scratch buffers.
+struct NativeModelData {
+  NativeGRUWeights weights;
+  std::array<uint8_t, 156> patch = {0};
+  bool contains_patch = false;
+  size_t size = 0;  // Bytes of weights in memory, 0 for built-in models
+};
+
+// Reads the weights of an exported TorchScript model. Returns false if the
+// graph is not one of the supported topologies.
+bool load_native_weights(const std::string &filename, int n_outputs,
+                         NativeGRUWeights &weights);
+// Checks that layer sizes chain from 2 inputs to n_outputs.
+bool validate_native_weights(const NativeGRUWeights &weights, int n_outputs);
+// Bytes of weights and biases, as stored.
+size_t native_weights_size(const NativeGRUWeights &weights);
+
+// Kernels compiled for one GRU size, see select_gru_kernel. input and
+// output run n_frames frames at once: x holds rows of x_stride floats,
+// gates_x rows of 3*hidden, h rows of hidden and y rows of y_stride. output
+// is only set for models whose output MLP is a single 6-row layer.
+struct GRUKernelOps {
+  void (*input)(const NativeGRUWeights &weights, const float *x, int x_stride,
+                float *gates_x, int n_frames);
+  void (*recur)(const NativeGRUWeights &weights, const float *gates_x,
+                float *gates_h, float *h);
+  void (*output)(const NativeGRUWeights &weights, const float *h, float *y,
+                 int y_stride, int n_frames);
+};
+// Returns the kernels specialised for the sizes of weights (hidden 32, 64,
+// 128 or 256, GRU input 2 or hidden), or nullptr if the generic kernels must
+// run it.
+const GRUKernelOps *select_gru_kernel(const NativeGRUWeights &weights,
+                                      int n_outputs);
+
+class NativeGRU {
+ public:
+  NativeGRU();
+  bool init(const std::string &filename, int n_outputs);
+  void get_patch(std::array<uint8_t, 156> &dest);
+  bool contains_patch();
+  int get_state_len();
+  std::shared_ptr<const NativeModelData> get_data() { return _data; }
+  size_t get_weights_size() { return _data ? _data->size : 0; }
+  // Steps the model once. state_array holds the GRU hidden state.
+  void call(std::array<float, 2> input_array, std::vector<float> &output_array,
+            std::vector<float> &state_array);
+  // Steps the model n_frames times. input_array holds [n_frames x 2] frames,
+  // output_array receives [n_frames x n_outputs]. Both MLPs and the GRU input
+  // projection are computed for all frames at once, only the recurrence is
+  // sequential.
+  void call_sequence(const float *input_array, int n_frames,
+                     float *output_array, std::vector<float> &state_array);
+  // Preallocates the scratch buffers of call_sequence.
+  void prepare_sequence(int max_frames);
+
+ private:
+  void gru_update(const float *gates_x, float *h);
+
+  std::shared_ptr<const NativeModelData> _data;
+  const NativeGRUWeights *_weights = nullptr;  // Points into _data
+  const GRUKernelOps *_kernel = nullptr;       // nullptr: generic kernels
+  std::vector<float> _gates_x;  // W_ih x + b_ih
+  std::vector<float> _gates_h;  // W_hh h + b_hh
+  std::vector<float> _mlp_a;    // MLP ping-pong buffers
+  std::vector<float> _mlp_b;
+  std::vector<float> _seq_a;        // [max_frames x _seq_stride] ping-pong
+  std::vector<float> _seq_b;
+  std::vector<float> _seq_gates_x;  // [max_frames x 3*hidden]
+  std::vector<float> _seq_h;        // [max_frames x hidden]
+  int _seq_stride = 0;              // Widest MLP layer
+  int _max_frames = 0;
+  int _n_outputs = 0;
+};
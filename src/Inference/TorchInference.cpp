@@ -38,24 +38,105 @@ Implements inference and patch retrieval methods on TorchScript models.
 */
 
 #include "TorchInference.hpp"
+#include "InferenceThreading.hpp"
+#include "TorchScriptArchive.hpp"
+#include "WeightRegistry.hpp"
 
+#include <torch/csrc/jit/runtime/graph_executor.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+
+namespace {
+
+const char *optimization_name(TorchOptimization optimization) {
+  switch (optimization) {
+    case TorchOptimization::FREEZE: return "frozen";
+    case TorchOptimization::FREEZE_AND_OPTIMIZE: return "optimized";
+    default: return "";
+  }
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/*
+  Freezes the module and optionally runs the inference optimizations on it.
+  Returns the module unchanged if a pass fails, e.g. on graphs that mutate
+  their attributes.
+*/
+torch::jit::script::Module optimize_module(
+    const torch::jit::script::Module &module, TorchOptimization optimization) {
+  if (optimization == TorchOptimization::NONE) return module;
+  try {
+    auto start = std::chrono::steady_clock::now();
+    torch::jit::script::Module frozen = module;  // A handle to the same module
+    frozen.eval();
+    frozen = torch::jit::freeze(frozen);  // Returns a frozen clone
+    std::cout << "\tFrozen in " << ms_since(start) << " ms\n";
+    if (optimization == TorchOptimization::FREEZE_AND_OPTIMIZE) {
+      start = std::chrono::steady_clock::now();
+      frozen = torch::jit::optimize_for_inference(frozen);
+      std::cout << "\tOptimized for inference in " << ms_since(start)
+                << " ms\n";
+    }
+    return frozen;
+  } catch (const c10::Error &e) {
+    std::cerr << "[LIBTORCH MODULE] Could not optimize the module, running "
+                 "it as loaded: "
+              << e.what_without_backtrace() << std::endl;
+    return module;
+  }
+}
+
+}  // namespace
+
+void set_torch_executor(TorchExecutor executor) {
+  torch::jit::getExecutorMode() = (executor != TorchExecutor::LEGACY);
+  torch::jit::getProfilingMode() = (executor == TorchExecutor::PROFILING);
+}
 
 TorchModel::TorchModel() {}
 
-void TorchModel::init(InferenceConfig config) {
+bool TorchModel::init(InferenceConfig config) {
   _config = config;
   _isTypeES = (_config.state_len == 0) ? false : true;
   {
   torch::NoGradGuard no_guard;  // Will only disable grads in current thread.
+  // Exposed state models keep no state in the module, so every instance
+  // loading the same file shares one module. Standalone models update their
+  // own state and get a private copy.
+  auto load = [&]() -> std::shared_ptr<torch::jit::script::Module> {
     try {
-    // Deserialize the ScriptModule from a file using torch::jit::load().
-    _module = torch::jit::load(_config.filename.c_str());
-  } catch (const c10::Error &e) {
-    std::cerr << "[LIBTORCH MODULE] error loading the model "
-              << _config.filename << std::endl;
-    return;
-  }
+      // Deserialize the ScriptModule from a file using torch::jit::load().
+      const auto start = std::chrono::steady_clock::now();
+      torch::jit::script::Module module =
+          torch::jit::load(_config.filename.c_str());
+      std::cout << "[LIBTORCH MODULE] Deserialized in " << ms_since(start)
+                << " ms\n";
+      return std::make_shared<torch::jit::script::Module>(
+          optimize_module(module, _config.optimization));
+    } catch (const c10::Error &e) {
+      std::cerr << "[LIBTORCH MODULE] error loading the model "
+                << _config.filename << std::endl;
+      return nullptr;
+    }
+  };
+  if (_isTypeES)
+    _shared_module =
+        WeightRegistry<torch::jit::script::Module>::instance().acquire(
+            _config.filename, load, optimization_name(_config.optimization));
+  else
+    _shared_module = load();
+  if (!_shared_module) return false;
+  // Module is a handle, this copy refers to the same object.
+  _module = *_shared_module;
+  read_archive();
 
   const std::string base_filename =
       _config.filename.substr(_config.filename.find_last_of("/\\") + 1);
@@ -76,6 +157,17 @@ void TorchModel::init(InferenceConfig config) {
   // Execute the model
   auto outputs = _module.forward(inputs);
 
+  // Persistent tensors and stack for call().
+  _forward = &_module.get_method("forward").function();
+  _self = torch::jit::IValue(_module._ivalue());
+  _input_tensor = torch::zeros(
+      {_config.input_sizes[0], _config.input_sizes[1], _config.input_sizes[2]});
+  if (_isTypeES)
+    _state_tensor = torch::zeros(
+        {_config.input_sizes[0], _config.input_sizes[1], _config.state_len});
+  _stack.reserve(3);
+  prepare_sequence(_config.input_sizes[1]);
+
   // Process its output.
   if (_isTypeES)  // Model is exposed state
   {
@@ -101,56 +193,44 @@ void TorchModel::init(InferenceConfig config) {
               << ", " << output.size(2) << "]" << '\n';
   }
   }
+  return true;
 }
 
-bool TorchModel::contains_patch() {
-  // Check if the module contains a training patch in buffer.
+/*
+  The training patch is the first buffer of the module. Frozen modules no
+  longer have it, it is read from the archive instead, and so is the size of
+  the weights they fold into their graph.
+*/
+void TorchModel::read_archive() {
+  TorchScriptArchive archive;
+  const bool opened = archive.open(_config.filename);
+  _weights_size = opened ? archive.get_tensor_bytes() : 0;
   const int n_buffers = _module.buffers().size();
   std::cerr << "[LIBTORCH MODULE] Module buffer count:" << n_buffers
             << std::endl;
-  if (n_buffers > 0) return true;
-
-  return false;
-}
-
-void TorchModel::get_patch(std::array<uint8_t, 156> &dest) {
-  const int n_buffers = _module.buffers().size();
   if (n_buffers > 0) {
-    //Print tensor
-    //std::cout << "                  First buffer:\n"
-    //          << *(_module.buffers().begin()) << std::endl;
-    const int tensor_len = (*(_module.buffers().begin())).size(0);
-    uint8_t *patch = (*_module.buffers().begin()).data_ptr<uint8_t>();
-    std::copy(patch, patch + tensor_len, dest.begin());
-    //std::cout << "\nCopied buffer: [";
-    //for (uint8_t val : dest) std::cout << " " << static_cast<int16_t>(val);
-    //std::cout << " ]\n";
+    at::Tensor buffer = *_module.buffers().begin();
+    const int tensor_len =
+        std::min((int)buffer.size(0), (int)_patch.size());
+    uint8_t *patch = buffer.data_ptr<uint8_t>();
+    std::copy(patch, patch + tensor_len, _patch.begin());
+    _containsPatch = true;
+  } else if (_config.optimization != TorchOptimization::NONE) {
+    _containsPatch = opened && archive.get_patch(_patch);
   }
 }
-/*
-Execute a forward pass for a standalone model
-*/
-void TorchModel::call(std::array<float, 2> input_array,
-                      std::vector<float> &output_array) {
-  {
-  torch::NoGradGuard no_guard;  // Will only disable grads in current thread.
-  /* Exposes the given data as a Tensor without taking ownership of the original
-   * data. */
-  at::Tensor input_tensor = torch::from_blob(
-      input_array.data(),
-      {_config.input_sizes[0], _config.input_sizes[1], _config.input_sizes[2]});
 
-  // std::cout << "Input "<< input_tensor << '\n';
-  std::vector<torch::jit::IValue> inputs;
-  inputs.push_back(input_tensor);
+bool TorchModel::contains_patch() { return _containsPatch; }
 
-  // Execute the model and turn its output (which is another jit::IValue) into a
-  // tensor!
-  at::Tensor output = _module.forward(inputs).toTensor();
-  auto out_a = output.accessor<float, 3>();
+void TorchModel::get_patch(std::array<uint8_t, 156> &dest) {
+  if (_containsPatch) dest = _patch;
+}
+void TorchModel::copy_output(const at::Tensor &model_out,
+                             std::vector<float> &output_array) {
+  auto out_a = model_out.accessor<float, 3>();
   std::array<int, 3> access_indexes = _config.fixed_slices;
 
-  for (int i = 0; i < output.size(_config.rolling_slice); i++) {
+  for (int i = 0; i < model_out.size(_config.rolling_slice); i++) {
     /* Do not apply sigmoid activation and multiply by max_ol.
        This should be done within the torchscript now. */
 
@@ -158,65 +238,91 @@ void TorchModel::call(std::array<float, 2> input_array,
     output_array[i] =
         out_a[access_indexes[0]][access_indexes[1]][access_indexes[2]];
   }
-  }
 }
 
 /*
-Execute a forward pass for an exposed state model
+Execute a forward pass. Runs the forward function directly on the reused
+stack ([self, input, state]), which avoids the argument vector copies of
+Module::forward.
 */
-void TorchModel::call(std::array<float, 2> input_array,
-                      std::vector<float> &output_array,
-                      std::vector<float> &state_array) {
-  // std::cout << "[DEBUG] Running call in ES model." << std::endl;
-  
-  {
+void TorchModel::call(const std::array<float, 2> &input_array,
+                      std::vector<float> &output_array) {
+  init_inference_thread();
   torch::NoGradGuard no_guard;  // Will only disable grads in current thread.
-  /* Exposes the given data as a Tensor without taking ownership of the original
-   * data. */
-  at::Tensor input_tensor = torch::from_blob(
-      input_array.data(),
-      {_config.input_sizes[0], _config.input_sizes[1], _config.input_sizes[2]});
-
-  at::Tensor state_tensor = torch::from_blob(
-      state_array.data(),
-      {_config.input_sizes[0], _config.input_sizes[1], _config.state_len});
-
-  // std::cout << "Input "<< input_tensor << '\n';
-  // std::cout << "State "<< state_tensor << '\n';
-  //  TODO: Not sure this will work like so, or if we require to create an
-  //  ivalue::Tuple.
-  std::vector<torch::jit::IValue> inputs;
-  inputs.push_back(input_tensor);
-  inputs.push_back(state_tensor);
+  float *input = _input_tensor.data_ptr<float>();
+  input[0] = input_array[0];
+  input[1] = input_array[1];
+
+  // clear() keeps the capacity reserved in init.
+  _stack.clear();
+  _stack.push_back(_self);
+  _stack.push_back(_input_tensor);
+  if (_isTypeES) _stack.push_back(_state_tensor);
+  _forward->run(_stack);
+
+  if (_isTypeES) {
+    // Output is an ivalue::tuple (outlevels, next_state)
+    const auto &elements = _stack.back().toTupleRef().elements();
+    copy_output(elements[0].toTensor(), output_array);
+    _state_tensor = elements[1].toTensor();
+  } else {
+    copy_output(_stack.back().toTensor(), output_array);
+  }
+}
 
-  torch::jit::IValue outputs;
-  outputs = _module.forward(inputs);
+void TorchModel::prepare_sequence(int max_frames) {
+  if (max_frames <= _max_frames) return;
+  _max_frames = max_frames;
+  _seq_input_tensor = torch::zeros(
+      {_config.input_sizes[0], _max_frames, _config.input_sizes[2]});
+}
 
-  // TODO: Correct this. just placeholder.
-  // Good info here:
-  // https://github.com/pytorch/pytorch/blob/master/aten/src/ATen/core/ivalue.h
-  at::Tensor model_out = outputs.toTuple()->elements()[0].toTensor();
-  at::Tensor model_state = outputs.toTuple()->elements()[1].toTensor();
+/*
+Execute n_frames steps at once. The GRU runs over the time dimension of the
+input, so the whole host block costs a single interpreter call.
+*/
+void TorchModel::call_sequence(const float *input_array, int n_frames,
+                               float *output_array) {
+  if (n_frames <= 0) return;
+  init_inference_thread();
+  torch::NoGradGuard no_guard;  // Will only disable grads in current thread.
+  if (n_frames > _max_frames) prepare_sequence(n_frames);  // Not expected
+  // Dimension 0 has size 1, so the narrowed view stays contiguous.
+  at::Tensor input = _seq_input_tensor.narrow(1, 0, n_frames);
+  std::memcpy(input.data_ptr<float>(), input_array,
+              sizeof(float) * n_frames * _config.input_sizes[2]);
+
+  _stack.clear();
+  _stack.push_back(_self);
+  _stack.push_back(input);
+  if (_isTypeES) _stack.push_back(_state_tensor);
+  _forward->run(_stack);
+
+  at::Tensor model_out;
+  if (_isTypeES) {
+    const auto &elements = _stack.back().toTupleRef().elements();
+    model_out = elements[0].toTensor();
+    _state_tensor = elements[1].toTensor();
+  } else {
+    model_out = _stack.back().toTensor();
+  }
 
-  // Copy output to vector
+  // Output is [1, n_frames, output_len]
   auto out_a = model_out.accessor<float, 3>();
-  std::array<int, 3> access_indexes = _config.fixed_slices;
-
-  for (int i = 0; i < model_out.size(_config.rolling_slice); i++) {
-    /* Do not apply sigmoid activation and multiply by max_ol.
-       This should be done within the torchscript now. */
+  for (int t = 0; t < n_frames; t++)
+    for (int i = 0; i < _config.output_len; i++)
+      output_array[t * _config.output_len + i] = out_a[0][t][i];
+}
 
-    access_indexes[_config.rolling_slice] = i;
-    output_array[i] =
-        out_a[access_indexes[0]][access_indexes[1]][access_indexes[2]];
-  }
+bool TorchModel::reset_state() {
+  if (!_isTypeES) return false;
+  _state_tensor.zero_();
+  return true;
+}
 
-  // Copy state to vector
-  out_a = model_state.accessor<float, 3>();
-  for (int i = 0; i < model_state.size(_config.rolling_slice); i++) {
-    access_indexes[_config.rolling_slice] = i;
-    state_array[i] =
-        out_a[access_indexes[0]][access_indexes[1]][access_indexes[2]];
-  }
-  }
-}
\ No newline at end of file
+void TorchModel::get_state(std::vector<float> &state_array) {
+  if (!_isTypeES) return;
+  at::Tensor state = _state_tensor.contiguous();
+  const float *data = state.data_ptr<float>();
+  state_array.assign(data, data + state.numel());
+}
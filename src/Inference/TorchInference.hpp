@@ -36,6 +36,8 @@ File: TorchInference.hpp
 Wrapper for RNN inference using libtorch.
 */
 
+#pragma once
+
 #include <torch/script.h>  // One-stop header.
 
 #include <array>
@@ -45,6 +47,11 @@ Wrapper for RNN inference using libtorch.
 #include <string>
 #include <vector>
 
+#include "InferenceBackend.hpp"
+
+// Selects the graph executor, see TorchExecutor.
+void set_torch_executor(TorchExecutor executor);
+
 struct InferenceConfig {
   std::string filename;
   std::array<int, 3> input_sizes;  // Size of input tensor
@@ -53,20 +60,57 @@ struct InferenceConfig {
       2;  // Slice ID to iterate through and extract output values
   int output_len = 128;  // Total length of output
   int state_len = 0;
+  TorchOptimization optimization = TorchOptimization::FREEZE_AND_OPTIMIZE;
 };
 
+/*
+  Input tensors and the interpreter stack are built once in init(). For
+  exposed state (ES) models the state returned by forward() is fed back as the
+  next input, so it never leaves libtorch. Modules are frozen and optimized
+  on load (see InferenceConfig::optimization), which folds their buffers, so
+  the patch and the size of the weights are read from the archive.
+*/
 class TorchModel {
  public:
   TorchModel();
-  void init(InferenceConfig config);
+  bool init(InferenceConfig config);
   void get_patch(std::array<uint8_t, 156> &dest);
   bool contains_patch();
-  void call(std::array<float, 2> input_array, std::vector<float> &output_array);
-  void call(std::array<float, 2> input_array, std::vector<float> &output_array,
-            std::vector<float> &state_array);
+  // Writes output_len values into output_array, which must be preallocated.
+  void call(const std::array<float, 2> &input_array,
+            std::vector<float> &output_array);
+  // Runs n_frames steps in a single forward pass over the time dimension.
+  // input_array holds [n_frames x 2] frames, output_array receives
+  // [n_frames x output_len] values, both row major.
+  void call_sequence(const float *input_array, int n_frames,
+                     float *output_array);
+  // Preallocates the sequence input so call_sequence does not allocate.
+  void prepare_sequence(int max_frames);
+  bool reset_state();
+  void get_state(std::vector<float> &state_array);
+  // Bytes of the module tensors, and the module holding them (shared by
+  // exposed state models loading the same file).
+  size_t get_weights_size() { return _weights_size; }
+  const void *get_weights_id() { return _shared_module.get(); }
 
  private:
+  void copy_output(const at::Tensor &model_out,
+                   std::vector<float> &output_array);
+  void read_archive();
+
+  // Keeps the registry entry alive, _module is a handle to the same module.
+  std::shared_ptr<const torch::jit::script::Module> _shared_module;
   torch::jit::script::Module _module;
+  torch::jit::Function *_forward = nullptr;  // Owned by _module
+  torch::jit::IValue _self;                  // Module object, first argument
+  torch::jit::Stack _stack;                  // Reused interpreter stack
+  at::Tensor _input_tensor;
+  at::Tensor _seq_input_tensor;              // [1, max_frames, 2]
+  int _max_frames = 0;
+  at::Tensor _state_tensor;
   InferenceConfig _config = InferenceConfig();
   bool _isTypeES = false;
+  bool _containsPatch = false;
+  std::array<uint8_t, 156> _patch = {0};
+  size_t _weights_size = 0;
 };
\ No newline at end of file
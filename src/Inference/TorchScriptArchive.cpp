@@ -0,0 +1,462 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: TorchScriptArchive.cpp
+Implements zip indexing and pickle decoding for TorchScript archives.
+*/
+
+#include "TorchScriptArchive.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+uint16_t read_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+int64_t storage_element_size(const std::string &dtype) {
+  if (dtype == "FloatStorage") return 4;
+  if (dtype == "ByteStorage" || dtype == "CharStorage" ||
+      dtype == "BoolStorage")
+    return 1;
+  if (dtype == "IntStorage") return 4;
+  if (dtype == "LongStorage" || dtype == "DoubleStorage") return 8;
+  return 0;
+}
+
+PickleValuePtr make_value(PickleValue::Kind kind) {
+  auto value = std::make_shared<PickleValue>();
+  value->kind = kind;
+  return value;
+}
+
+/*
+  Stack machine for pickle protocol 2, as written by torch.jit.save.
+  Persistent ids are kept as the raw tuple, and torch._utils._rebuild_tensor_v2
+  is resolved into a TENSOR value pointing at its storage record.
+*/
+class Unpickler {
+ public:
+  Unpickler(const uint8_t *data, size_t size, const std::string &record_prefix)
+      : _data(data), _size(size), _prefix(record_prefix) {}
+
+  PickleValuePtr run() {
+    while (_pos < _size) {
+      const uint8_t op = _data[_pos++];
+      switch (op) {
+        case 0x80:  // PROTO
+          _pos += 1;
+          break;
+        case '.':  // STOP
+          return _stack.empty() ? nullptr : _stack.back();
+        case '(':  // MARK
+          _marks.push_back(_stack.size());
+          break;
+        case 'N':
+          push(make_value(PickleValue::NONE));
+          break;
+        case 0x88:  // NEWTRUE
+        case 0x89: {  // NEWFALSE
+          auto v = make_value(PickleValue::BOOL);
+          v->i = (op == 0x88) ? 1 : 0;
+          push(v);
+          break;
+        }
+        case 'K':  // BININT1
+          if (!need(1)) return nullptr;
+          push_int(_data[_pos]);
+          _pos += 1;
+          break;
+        case 'M':  // BININT2
+          if (!need(2)) return nullptr;
+          push_int(read_u16(_data + _pos));
+          _pos += 2;
+          break;
+        case 'J':  // BININT
+          if (!need(4)) return nullptr;
+          push_int((int32_t)read_u32(_data + _pos));
+          _pos += 4;
+          break;
+        case 0x8a: {  // LONG1
+          if (!need(1)) return nullptr;
+          const int n = _data[_pos++];
+          if (n > 8 || !need(n)) return nullptr;
+          int64_t v = 0;
+          for (int b = 0; b < n; b++) v |= (int64_t)_data[_pos + b] << (8 * b);
+          if (n > 0 && n < 8 && (_data[_pos + n - 1] & 0x80))
+            v -= (int64_t)1 << (8 * n);
+          _pos += n;
+          push_int(v);
+          break;
+        }
+        case 'G': {  // BINFLOAT, big endian double
+          if (!need(8)) return nullptr;
+          uint64_t bits = 0;
+          for (int b = 0; b < 8; b++) bits = (bits << 8) | _data[_pos + b];
+          _pos += 8;
+          auto v = make_value(PickleValue::FLOAT);
+          std::memcpy(&v->f, &bits, sizeof(double));
+          push(v);
+          break;
+        }
+        case 'X': {  // BINUNICODE
+          if (!need(4)) return nullptr;
+          const uint32_t n = read_u32(_data + _pos);
+          _pos += 4;
+          if (!need(n)) return nullptr;
+          auto v = make_value(PickleValue::STRING);
+          v->str.assign((const char *)_data + _pos, n);
+          _pos += n;
+          push(v);
+          break;
+        }
+        case 'c': {  // GLOBAL module\nname\n
+          auto v = make_value(PickleValue::GLOBAL);
+          v->str = read_line() + ".";
+          v->str += read_line();
+          push(v);
+          break;
+        }
+        case ')':
+          push(make_value(PickleValue::TUPLE));
+          break;
+        case ']':
+          push(make_value(PickleValue::LIST));
+          break;
+        case '}':
+          push(make_value(PickleValue::DICT));
+          break;
+        case 't': {  // TUPLE
+          auto v = make_value(PickleValue::TUPLE);
+          v->items = pop_mark();
+          push(v);
+          break;
+        }
+        case 0x85:  // TUPLE1
+        case 0x86:  // TUPLE2
+        case 0x87: {  // TUPLE3
+          const size_t n = op - 0x84;
+          if (_stack.size() < n) return nullptr;
+          auto v = make_value(PickleValue::TUPLE);
+          v->items.assign(_stack.end() - n, _stack.end());
+          _stack.resize(_stack.size() - n);
+          push(v);
+          break;
+        }
+        case 'a': {  // APPEND
+          auto item = pop();
+          if (!item || _stack.empty()) return nullptr;
+          _stack.back()->items.push_back(item);
+          break;
+        }
+        case 'e':  // APPENDS
+        case 'u': {  // SETITEMS
+          auto items = pop_mark();
+          if (_stack.empty()) return nullptr;
+          auto &dest = _stack.back()->items;
+          dest.insert(dest.end(), items.begin(), items.end());
+          break;
+        }
+        case 's': {  // SETITEM
+          auto value = pop();
+          auto key = pop();
+          if (!key || _stack.empty()) return nullptr;
+          _stack.back()->items.push_back(key);
+          _stack.back()->items.push_back(value);
+          break;
+        }
+        case 'q':  // BINPUT
+          if (!need(1) || _stack.empty()) return nullptr;
+          _memo[_data[_pos]] = _stack.back();
+          _pos += 1;
+          break;
+        case 'r':  // LONG_BINPUT
+          if (!need(4) || _stack.empty()) return nullptr;
+          _memo[read_u32(_data + _pos)] = _stack.back();
+          _pos += 4;
+          break;
+        case 'h':  // BINGET
+          if (!need(1)) return nullptr;
+          push(_memo[_data[_pos]]);
+          _pos += 1;
+          break;
+        case 'j':  // LONG_BINGET
+          if (!need(4)) return nullptr;
+          push(_memo[read_u32(_data + _pos)]);
+          _pos += 4;
+          break;
+        case 'Q':  // BINPERSID: keep the persistent id tuple as is.
+          break;
+        case 'R': {  // REDUCE
+          auto args = pop();
+          auto callable = pop();
+          if (!args || !callable) return nullptr;
+          push(reduce(callable, args));
+          break;
+        }
+        case 0x81: {  // NEWOBJ
+          auto args = pop();
+          auto cls = pop();
+          if (!args || !cls) return nullptr;
+          auto v = make_value(PickleValue::OBJECT);
+          v->str = cls->str;
+          v->items = args->items;
+          push(v);
+          break;
+        }
+        case 'b': {  // BUILD
+          auto state = pop();
+          if (!state || _stack.empty()) return nullptr;
+          _stack.back()->items.push_back(state);
+          break;
+        }
+        default:
+          std::cerr << "[TS ARCHIVE] Unsupported pickle opcode 0x" << std::hex
+                    << (int)op << std::dec << std::endl;
+          return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  bool need(size_t n) const { return _pos + n <= _size; }
+  void push(PickleValuePtr v) { _stack.push_back(v ? v : make_value(PickleValue::NONE)); }
+  void push_int(int64_t value) {
+    auto v = make_value(PickleValue::INT);
+    v->i = value;
+    push(v);
+  }
+  PickleValuePtr pop() {
+    if (_stack.empty()) return nullptr;
+    auto v = _stack.back();
+    _stack.pop_back();
+    return v;
+  }
+  std::vector<PickleValuePtr> pop_mark() {
+    std::vector<PickleValuePtr> items;
+    if (_marks.empty()) return items;
+    const size_t mark = _marks.back();
+    _marks.pop_back();
+    if (mark > _stack.size()) return items;
+    items.assign(_stack.begin() + mark, _stack.end());
+    _stack.resize(mark);
+    return items;
+  }
+  std::string read_line() {
+    std::string line;
+    while (_pos < _size && _data[_pos] != '\n') line += (char)_data[_pos++];
+    _pos++;  // Skip newline
+    return line;
+  }
+  PickleValuePtr reduce(const PickleValuePtr &callable,
+                        const PickleValuePtr &args) {
+    // _rebuild_tensor_v2(storage, offset, size, stride, requires_grad, hooks)
+    if (callable->str == "torch._utils._rebuild_tensor_v2" &&
+        args->items.size() >= 4) {
+      const auto &pid = args->items[0];
+      // pid: ('storage', torch.FloatStorage, key, location, numel)
+      if (pid->kind == PickleValue::TUPLE && pid->items.size() >= 3) {
+        auto v = make_value(PickleValue::TENSOR);
+        const std::string &storage = pid->items[1]->str;
+        v->dtype = storage.substr(storage.find_last_of('.') + 1);
+        v->str = _prefix + pid->items[2]->str;
+        v->offset = args->items[1]->i;
+        for (const auto &dim : args->items[2]->items) v->shape.push_back(dim->i);
+        // Only contiguous tensors are supported.
+        int64_t expected_stride = 1;
+        const auto &strides = args->items[3]->items;
+        for (int d = (int)strides.size() - 1; d >= 0; d--) {
+          if (v->shape[d] != 1 && strides[d]->i != expected_stride)
+            return make_value(PickleValue::NONE);
+          expected_stride *= v->shape[d];
+        }
+        return v;
+      }
+    }
+    auto v = make_value(PickleValue::OBJECT);
+    v->str = callable->str;
+    v->items = args->items;
+    return v;
+  }
+
+  const uint8_t *_data;
+  size_t _size;
+  size_t _pos = 0;
+  std::string _prefix;
+  std::vector<PickleValuePtr> _stack;
+  std::vector<size_t> _marks;
+  std::map<uint32_t, PickleValuePtr> _memo;
+};
+
+}  // namespace
+
+TorchScriptArchive::TorchScriptArchive() {}
+
+bool TorchScriptArchive::open(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    std::cerr << "[TS ARCHIVE] Could not open " << filename << std::endl;
+    return false;
+  }
+  const std::streamsize size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  _filedata.resize(size);
+  if (!file.read((char *)_filedata.data(), size)) return false;
+  return open(_filedata.data(), _filedata.size());
+}
+
+bool TorchScriptArchive::open(const uint8_t *data, size_t size) {
+  _data = data;
+  _size = size;
+  _records.clear();
+
+  // Find the End Of Central Directory record, scanning backwards.
+  constexpr size_t eocd_len = 22;
+  if (size < eocd_len) return false;
+  size_t eocd = size - eocd_len;
+  const size_t scan_limit = (size > 0xFFFF + eocd_len) ? size - 0xFFFF - eocd_len : 0;
+  while (read_u32(data + eocd) != 0x06054b50) {
+    if (eocd == scan_limit) {
+      std::cerr << "[TS ARCHIVE] Not a zip archive." << std::endl;
+      return false;
+    }
+    eocd--;
+  }
+  const uint16_t n_entries = read_u16(data + eocd + 10);
+  size_t cd = read_u32(data + eocd + 16);
+
+  for (int e = 0; e < n_entries; e++) {
+    if (cd + 46 > size || read_u32(data + cd) != 0x02014b50) return false;
+    const uint16_t method = read_u16(data + cd + 10);
+    const uint32_t csize = read_u32(data + cd + 20);
+    const uint16_t name_len = read_u16(data + cd + 28);
+    const uint16_t extra_len = read_u16(data + cd + 30);
+    const uint16_t comment_len = read_u16(data + cd + 32);
+    const uint32_t local = read_u32(data + cd + 42);
+    std::string name((const char *)data + cd + 46, name_len);
+    cd += 46 + name_len + extra_len + comment_len;
+
+    // Compressed records (code, debug info) are never needed for inference.
+    if (method != 0) continue;
+    if (local + 30 > size || read_u32(data + local) != 0x04034b50) return false;
+    const size_t offset = local + 30 + read_u16(data + local + 26) +
+                          read_u16(data + local + 28);
+    if (offset + csize > size) return false;
+
+    // Strip the archive root folder (named after the model).
+    const size_t slash = name.find('/');
+    if (slash != std::string::npos) name = name.substr(slash + 1);
+    _records[name] = {offset, csize};
+  }
+  return true;
+}
+
+bool TorchScriptArchive::has_record(const std::string &name) const {
+  return _records.count(name) > 0;
+}
+
+const uint8_t *TorchScriptArchive::get_record(const std::string &name,
+                                              size_t &size) const {
+  auto it = _records.find(name);
+  if (it == _records.end()) {
+    size = 0;
+    return nullptr;
+  }
+  size = it->second.size;
+  return _data + it->second.offset;
+}
+
+PickleValuePtr TorchScriptArchive::unpickle(const std::string &name) const {
+  size_t size;
+  const uint8_t *data = get_record(name, size);
+  if (!data) return nullptr;
+  // Tensors in "foo.pkl" live in the "foo/" records.
+  const std::string prefix = name.substr(0, name.find_last_of('.')) + "/";
+  Unpickler unpickler(data, size, prefix);
+  return unpickler.run();
+}
+
+const uint8_t *TorchScriptArchive::get_tensor_data(const PickleValue &tensor,
+                                                   size_t &size) const {
+  size = 0;
+  if (tensor.kind != PickleValue::TENSOR) return nullptr;
+  const int64_t element_size = storage_element_size(tensor.dtype);
+  if (element_size == 0) return nullptr;
+  int64_t numel = 1;
+  for (int64_t dim : tensor.shape) numel *= dim;
+
+  size_t record_size;
+  const uint8_t *record = get_record(tensor.str, record_size);
+  const size_t begin = tensor.offset * element_size;
+  const size_t nbytes = numel * element_size;
+  if (!record || begin + nbytes > record_size) return nullptr;
+  size = nbytes;
+  return record + begin;
+}
+
+bool TorchScriptArchive::get_patch(std::array<uint8_t, 156> &dest) const {
+  auto root = unpickle("data.pkl");
+  if (!root || root->kind != PickleValue::OBJECT || root->items.empty())
+    return false;
+  // Module attributes are set through BUILD with a dict state.
+  const auto &state = root->items.back();
+  if (state->kind != PickleValue::DICT) return false;
+  for (size_t k = 0; k + 1 < state->items.size(); k += 2) {
+    const auto &value = state->items[k + 1];
+    if (value->kind != PickleValue::TENSOR) continue;
+    size_t size;
+    const uint8_t *patch = get_tensor_data(*value, size);
+    if (!patch || size != dest.size()) continue;
+    std::copy(patch, patch + size, dest.begin());
+    return true;
+  }
+  return false;
+}
+
+size_t TorchScriptArchive::get_tensor_bytes() const {
+  size_t bytes = 0;
+  for (const auto &record : _records)
+    if (record.first.rfind("data/", 0) == 0 ||
+        record.first.rfind("constants/", 0) == 0)
+      bytes += record.second.size;
+  return bytes;
+}
@@ -0,0 +1,104 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: TorchScriptArchive.hpp
+Minimal, libtorch-free reader for the TorchScript (.ts) archives exported by
+the Envelope Learning training pipeline.
+
+A TorchScript archive is a zip file whose tensor records are stored
+uncompressed. The reader maps record names to their raw bytes and decodes the
+subset of the pickle protocol used by data.pkl and constants.pkl, so that
+weights and the embedded DX7 patch can be fetched without torch::jit::load.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Decoded pickle value. Only the types found in TorchScript archives. */
+struct PickleValue {
+  enum Kind { NONE, BOOL, INT, FLOAT, STRING, TUPLE, LIST, DICT, GLOBAL,
+              OBJECT, TENSOR };
+  Kind kind = NONE;
+  int64_t i = 0;
+  double f = 0.0;
+  // STRING: text. GLOBAL / OBJECT: "module.name". TENSOR: storage record key.
+  std::string str;
+  // TUPLE / LIST: elements. DICT: key, value pairs flattened.
+  // OBJECT: constructor arguments followed by the BUILD state, if any.
+  std::vector<std::shared_ptr<PickleValue>> items;
+  // TENSOR only.
+  std::string dtype;  // Storage class, i.e. "FloatStorage"
+  int64_t offset = 0;
+  std::vector<int64_t> shape;
+};
+
+using PickleValuePtr = std::shared_ptr<PickleValue>;
+
+class TorchScriptArchive {
+ public:
+  TorchScriptArchive();
+  // Reads the archive into memory and indexes its records.
+  bool open(const std::string &filename);
+  // Indexes an archive that is already in memory. The data must outlive this.
+  bool open(const uint8_t *data, size_t size);
+  // Record names are relative to the archive root, i.e. "constants/0".
+  bool has_record(const std::string &name) const;
+  const uint8_t *get_record(const std::string &name, size_t &size) const;
+  // Decodes a pickled record (data.pkl, constants.pkl).
+  PickleValuePtr unpickle(const std::string &name) const;
+  // Raw bytes of a tensor decoded from a pickle.
+  const uint8_t *get_tensor_data(const PickleValue &tensor, size_t &size) const;
+  // Fetches the DX7 patch stored as the first module buffer.
+  bool get_patch(std::array<uint8_t, 156> &dest) const;
+  // Bytes of tensor storage (data/ and constants/ records), what loading
+  // the module allocates for its weights.
+  size_t get_tensor_bytes() const;
+
+ private:
+  struct Record {
+    size_t offset;
+    size_t size;
+  };
+  std::vector<uint8_t> _filedata;
+  const uint8_t *_data = nullptr;
+  size_t _size = 0;
+  std::map<std::string, Record> _records;
+};
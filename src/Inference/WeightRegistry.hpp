@@ -0,0 +1,114 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: WeightRegistry.hpp
+Process-wide registry of immutable model data, shared by plugin instances.
+
+Instances that load the same file (same path and modification time) get the
+same copy of the weights and patch. The registry only holds weak references,
+so a model is freed when the last instance using it releases it, and
+resident memory grows with the number of unique models, not instances.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Modification time of path, 0 if it can not be read.
+inline int64_t model_file_mtime(const std::string &path) {
+  std::error_code error;
+  const auto mtime = std::filesystem::last_write_time(path, error);
+  return error ? 0 : (int64_t)mtime.time_since_epoch().count();
+}
+
+template <typename T>
+class WeightRegistry {
+ public:
+  // One registry per data type for the whole process.
+  static WeightRegistry &instance() {
+    static WeightRegistry registry;
+    return registry;
+  }
+
+  /*
+    Returns the shared data for path, calling load() if no live copy
+    exists. load() returns nullptr on failure, which is not stored. Loads
+    are serialized, so two instances never load the same file twice.
+    variant tells apart copies of one file prepared differently (e.g.
+    frozen and unfrozen TorchScript modules).
+  */
+  std::shared_ptr<const T> acquire(
+      const std::string &path,
+      const std::function<std::shared_ptr<T>()> &load,
+      const std::string &variant = "") {
+    const std::string key = path + "@" +
+                            std::to_string(model_file_mtime(path)) +
+                            (variant.empty() ? "" : "#" + variant);
+    std::lock_guard<std::mutex> lock(_mutex);
+    purge();
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+      if (auto shared = it->second.lock()) {
+        std::cout << "[WEIGHT REGISTRY] Sharing " << path << " ("
+                  << shared.use_count() << " users)" << std::endl;
+        return shared;
+      }
+    std::shared_ptr<const T> data = load();
+    if (data) _entries[key] = data;
+    return data;
+  }
+
+  // Number of models currently alive.
+  int get_count() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    purge();
+    return (int)_entries.size();
+  }
+
+ private:
+  WeightRegistry() {}
+  void purge() {
+    for (auto it = _entries.begin(); it != _entries.end();)
+      it = it->second.expired() ? _entries.erase(it) : std::next(it);
+  }
+
+  std::mutex _mutex;
+  std::map<std::string, std::weak_ptr<const T>> _entries;
+};
@@ -70,11 +70,17 @@ static juce::String fmCoarse6{"coarse6"};
 static juce::String debug1{"debug1"};
 static juce::String debug2{"debug2"};
 static juce::String debug3{"debug3"};
+static juce::String debug4{"debug4"};
 static juce::String debug5{"debug5"};
 static juce::String debug6{"debug6"};
 static juce::String debug7{"debug7"};
 static juce::String debug8{"debug8"};
 static juce::String debug9{"debug9"};
 
+static juce::String torchIntraOp{"torch_intraop_threads"};
+static juce::String torchInterOp{"torch_interop_threads"};
+static juce::String controlRateTolerance{"control_rate_tolerance"};
+static juce::String pipelinedInference{"pipelined_inference"};
+
 static juce::Identifier oscilloscope{"oscilloscope"};
 }  // namespace IDs
\ No newline at end of file
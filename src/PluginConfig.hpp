@@ -70,6 +70,28 @@ struct PluginConfig
     bool infinite_sustain;
     bool allow_model_reset;
     bool enableOSCOutput;
+    int model_crossfade_blocks; // fmblocks to crossfade envelopes on model change. 0 = off
+    int model_cache_mb;         // Memory budget of the model cache
+    int model_prefetch_radius;  // Neighbours of the selected model to prefetch
+    int model_warmup_steps;     // Host blocks of synthetic input run on load
+    int torch_optimization;     // TorchOptimization: 0 none, 1 freeze, 2 freeze + optimize
+    int torch_executor;         // TorchExecutor: 0 profiling, 1 simple, 2 legacy
+    int torch_intraop_threads;  // libtorch threads per forward pass. 0 = default
+    int torch_interop_threads;  // libtorch inter-op pool size. 0 = default
+    float inference_budget;     // Share of the buffer duration inference may use. 0 = off
+    int inference_chunk_fmblocks; // fmblocks per call after a miss
+    int inference_chunk_blocks;   // Host blocks chunked after a miss. 0 = never
+    float control_rate_tolerance; // Skip model steps on steady input. 0 = off
+    int control_rate_max_stride;  // Most fmblocks interpolated in a row
+    bool usePipelinedInference; // Step models on a worker, one fmblock of latency,
+                                // at 64-sample buffers only
+    int fm_sine_engine;         // FMSineEngine: 0 exact, 1 polynomial, 2 table, 3 phasor
+    bool fm_exact_offline;      // Exact sine when the host renders offline
+    float fm_prune_level;       // Output error allowed to skip FM operators
+    float fm_cycle_tolerance;   // Output error allowed to play a cached cycle. <0 = off
+    int idle_fmblocks;          // Silent fmblocks before processing stops. 0 = off
+    float idle_threshold;       // Input peak below which an fmblock is silent
+    int pipeline_core;          // Core the worker is pinned to. -1 = any
     
     // FM Synth config
     unsigned int fm_config = 0;
@@ -83,6 +105,7 @@ struct PluginConfig
     bool enableConsoleOutput;
     bool skipInference;
     bool enableAudioPassthrough;
+    bool useNativeInference;    // Step models with NativeGRU instead of libtorch
 
     PluginConfig()
         {
@@ -96,8 +119,30 @@ struct PluginConfig
         infinite_sustain = false;
         allow_model_reset = true;
         enableOSCOutput = true;
+        model_crossfade_blocks = 4;
+        model_cache_mb = 32;
+        model_prefetch_radius = 1;
+        model_warmup_steps = 8;
+        torch_optimization = 2;
+        torch_executor = 0;
+        torch_intraop_threads = 1;
+        torch_interop_threads = 1;
+        inference_budget = 0.5f;
+        inference_chunk_fmblocks = 4;
+        inference_chunk_blocks = 32;
+        control_rate_tolerance = 0.0f;
+        control_rate_max_stride = 4;
+        usePipelinedInference = false;
+        fm_sine_engine = 1;
+        fm_exact_offline = true;
+        fm_prune_level = 1e-4f;
+        fm_cycle_tolerance = -1.0f;
+        idle_fmblocks = 32;
+        idle_threshold = 1e-4f;
+        pipeline_core = -1;
         enableConsoleOutput = false;
         skipInference = false;
         enableAudioPassthrough = false;
+        useNativeInference = true;
         }
 };
@@ -53,6 +53,11 @@ BesselsProcessor::BesselsProcessor()
 
 {
   // Main Plugin Setup Tasks come here.
+  // Hosts construct the plugin many times while scanning, so nothing here
+  // touches the inference runtime or the network: the model loader thread
+  // and libtorch start with the first model request (see ModelLoader), the
+  // OSC socket opens in prepareToPlay().
+  const auto construction_start = std::chrono::steady_clock::now();
 
   // 1. Create new class members.
   //_pitch_tracker.reset(new Yin());
@@ -60,6 +65,16 @@ BesselsProcessor::BesselsProcessor()
   _rms_processor.reset(new RMS_Processor());
   //_rms_processor_feedback.reset(new RMS_Processor());
   _fmsynth.reset(new FMSynth());
+  _fm_ol.assign(6, 0.0f);
+  _meter_buffer.setSize(1, 1);
+  _model_loader.on_loaded = [this](const ModelLoadResult& result) {
+    {
+      const juce::SpinLock::ScopedLockType lock(_load_result_lock);
+      _load_result = result;
+    }
+    triggerAsyncUpdate();
+  };
+  _model_loader.set_cache_budget((size_t)_config.model_cache_mb * 1024 * 1024);
 
   // 2. Set GUI
   FOLEYS_SET_SOURCE_PATH(__FILE__);
@@ -73,12 +88,14 @@ BesselsProcessor::BesselsProcessor()
   magicState.setGuiValueTree (BinaryData::magic_bake_xml,
     BinaryData::magic_bake_xmlSize);
 
-  // OSC Live Debug Module
-  if (_osc_sender.connect("127.0.0.1", 12000))  // [4]
-    std::cout << "[OSC] Error: could not connect to UDP port 12000."
-              << std::endl;
-  else
-    std::cout << "[OSC] Connected: UDP port 12000." << std::endl;
+  // Cold: first instance in the process. Warm: shared state is initialized.
+  static std::atomic<int> instances{0};
+  const bool cold = (instances++ == 0);
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - construction_start)
+                      .count();
+  std::cout << "[STARTUP] Constructed in " << us << " us ("
+            << (cold ? "cold" : "warm") << ")" << std::endl;
 }
 
 /**
@@ -87,8 +104,13 @@ BesselsProcessor(): Destructor
 */
 BesselsProcessor::~BesselsProcessor() {
   /*Kill Renderer*/
+  _pipeline.stop();
+  delete _pipeline_retired;
+  _model_loader.stop();
+  cancelPendingUpdate();
   _fmsynth.reset();
   _model.reset();
+  _fade_model.reset();
   _rms_processor.reset();
   //_pitch_tracker.reset();
   _tracker_manager.reset();
@@ -102,8 +124,15 @@ inline float normalize_pitch(float pitch) {
   return midi_val / midi_highest_note;
 }
 
+// Largest magnitude of n samples.
+inline float peak_level(const float* x, int n) {
+  float peak = 0.0f;
+  for (int i = 0; i < n; i++) peak = std::max(peak, std::fabs(x[i]));
+  return peak;
+}
+
 inline void BesselsProcessor::sendDebugMessages(int fmblock,float pitch,
-  float pitch_norm,float rms_in, std::vector<float> fm_ol)
+  float pitch_norm,float rms_in, const std::vector<float> &fm_ol)
 {
   /* DEBUG OVER CONSOLE */
   if (_config.enableConsoleOutput == true) {
@@ -126,6 +155,15 @@ inline void BesselsProcessor::sendDebugMessages(int fmblock,float pitch,
     for (float value : fm_ol) msg2.addFloat32(value);
     _osc_sender.send(msg2);
 
+    // Inference deadline misses, once per host block.
+    if (fmblock == 0) {
+      juce::OSCMessage msg3("/watchdog");
+      msg3.addInt32(_inference_misses);
+      msg3.addInt32(_fallback_fmblocks);
+      msg3.addInt32(_skipped_steps);
+      _osc_sender.send(msg3);
+    }
+
     //if (_model) {
     //  if (_model->is_standalone() == false) {
     //    juce::OSCMessage msg3("/hidden");
@@ -140,6 +178,315 @@ inline void BesselsProcessor::sendDebugMessages(int fmblock,float pitch,
     }
 }
 
+/**
+runInference(): Computes the envelopes of every fmblock in the host block.
+
+Consecutive fmblocks are sent to the model as one sequence. A sequence is
+cut wherever the model has to be reset, so the state is cleared at the same
+fmblock as when inference ran block by block.
+
+Inference has a time budget per host block (inference_budget). A block
+that overruns it counts as a miss. The whole block is one call until a
+miss. The next inference_chunk_blocks host blocks are then cut in chunks
+of inference_chunk_fmblocks, so the budget can be checked between them:
+once the next chunk would not fit, the remaining fmblocks are extrapolated
+(see extrapolateEnvelopes). A stall inside a call is only caught when it
+returns.
+*/
+void BesselsProcessor::runInference() {
+  const int n_blocks = _config.num_fmblocks;
+  if (n_blocks <= 0) return;
+  _inference_start = juce::Time::getHighResolutionTicks();
+  _inference_late = false;
+  _inference_missed = false;
+  if (_pipelined) {
+    pushPipelineFrames();
+    return;
+  }
+  if (!_model || _config.skipInference == true) {
+    for (int fmblock = 0; fmblock < n_blocks; fmblock++) {
+      // Placeholder {1,0,0,0,0,0}
+      std::fill(_block_ol.begin() + fmblock * 6,
+                _block_ol.begin() + (fmblock + 1) * 6, 0.0f);
+      _block_ol[fmblock * 6] = 1.0f;
+    }
+    return;
+  }
+  // The tolerance is a parameter, it may change between blocks.
+  if (_control_rate_tolerance != _config.control_rate_tolerance) {
+    _control_rate_tolerance = _config.control_rate_tolerance;
+    for (AdaptiveControlRate* rate : {&_control_rate, &_fade_control_rate}) {
+      rate->set_tolerance(_control_rate_tolerance);
+      rate->reset();
+    }
+  }
+  runModel(*_model, _control_rate, _block_ol.data());
+  if (_fade_model) {
+    // Crossfade from the envelopes of the replaced model.
+    runModel(*_fade_model, _fade_control_rate, _block_ol_fade.data());
+    crossfadeEnvelopes();
+  }
+}
+
+// Blends _block_ol_fade into _block_ol over model_crossfade_blocks fmblocks.
+void BesselsProcessor::crossfadeEnvelopes() {
+  const int n_blocks = _config.num_fmblocks;
+  const int fade_len = std::max(_config.model_crossfade_blocks, 1);
+  for (int fmblock = 0; fmblock < n_blocks; fmblock++) {
+    const float a = std::min(1.0f, (float)(_fade_pos + 1) / fade_len);
+    for (int i = 0; i < 6; i++) {
+      const float old_ol = _block_ol_fade[fmblock * 6 + i];
+      _block_ol[fmblock * 6 + i] =
+          old_ol + a * (_block_ol[fmblock * 6 + i] - old_ol);
+    }
+    _fade_pos++;
+  }
+  if (_fade_pos >= fade_len && _model_loader.retire(_fade_model.get()))
+    _fade_model.release();
+}
+
+void BesselsProcessor::runModel(EnvModel& model, AdaptiveControlRate& rate,
+                                float* block_ol) {
+  const int n_blocks = _config.num_fmblocks;
+  // Chunks only pay off with a budget, and after a miss.
+  const int chunk = (_inference_budget_ticks > 0 && _chunked_blocks > 0)
+                        ? std::max(_config.inference_chunk_fmblocks, 1)
+                        : n_blocks;
+  int run_start = 0;
+  for (int fmblock = 0; fmblock < n_blocks; fmblock++) {
+    /* DNN Reset logic */
+    const bool reset = _config.allow_model_reset &&
+                       _block_rms[fmblock] <= 0.0 &&
+                       _block_pitch[fmblock] <= 0.0;
+    if (reset || fmblock - run_start >= chunk) {
+      runSequence(model, rate, block_ol, run_start, fmblock);
+      // Also reset when late, so the state is cleared where it would be.
+      if (reset) {
+        model.reset_state();
+        rate.reset();
+      }
+      run_start = fmblock;
+    }
+  }
+  runSequence(model, rate, block_ol, run_start, n_blocks);
+}
+
+/**
+runSequence(): Steps the model over fmblocks [start, end), or extrapolates
+them if the inference budget of the block is spent. Extrapolated fmblocks
+are not fed to the model: its state stays at the last computed fmblock, as
+if they had not been played.
+
+With a control rate tolerance, steady fmblocks are interpolated instead of
+stepped (see AdaptiveControlRate).
+*/
+void BesselsProcessor::runSequence(EnvModel& model, AdaptiveControlRate& rate,
+                                   float* block_ol, int start, int end) {
+  if (end <= start) return;
+  if (_inference_late) {
+    extrapolateEnvelopes(block_ol, start, end);
+    _fallback_fmblocks += end - start;
+    _inference_missed = true;
+    return;
+  }
+  const juce::int64 chunk_start = juce::Time::getHighResolutionTicks();
+  _skipped_steps += rate.call_sequence(model, &_block_pitch[start],
+                                       &_block_rms[start], end - start,
+                                       block_ol + start * 6);
+  if (_inference_budget_ticks <= 0) return;
+  const juce::int64 now = juce::Time::getHighResolutionTicks();
+  const juce::int64 spent = now - _inference_start;
+  if (spent > _inference_budget_ticks) _inference_missed = true;
+  // Late if a chunk as long as this one would not fit in the budget.
+  if (spent + (now - chunk_start) > _inference_budget_ticks)
+    _inference_late = true;
+}
+
+/**
+extrapolateEnvelopes(): Continues the envelopes with their last slope,
+halved every fmblock, so they settle on a held value instead of jumping.
+Rows wrap around: fmblock 0 continues from the end of the previous block,
+which is still in block_ol.
+*/
+void BesselsProcessor::extrapolateEnvelopes(float* block_ol, int start,
+                                            int end) {
+  const int n_blocks = _config.num_fmblocks;
+  for (int fmblock = start; fmblock < end; fmblock++) {
+    const float* prev = block_ol + ((fmblock + n_blocks - 1) % n_blocks) * 6;
+    const float* prev2 =
+        block_ol + ((fmblock + 2 * n_blocks - 2) % n_blocks) * 6;
+    float* ol = block_ol + fmblock * 6;
+    for (int i = 0; i < 6; i++)
+      ol[i] = std::max(0.0f, prev[i] + 0.5f * (prev[i] - prev2[i]));
+  }
+}
+
+/**
+adoptPendingModel(): Swaps in a model published by the loader thread, and
+applies its patch to the synth.
+
+The previous model is never deleted here. It is either kept running for the
+crossfade or handed back to the loader, which frees it on its own thread.
+*/
+void BesselsProcessor::adoptPendingModel() {
+  // A model replaced in pipelined mode is retired once the worker is done
+  // with the frames pushed with it.
+  if (_pipeline_retired &&
+      (!_pipeline.is_running() ||
+       _pipeline.completed() >= _pipeline_retired_index) &&
+      _model_loader.retire(_pipeline_retired))
+    _pipeline_retired = nullptr;
+  // Finish the current crossfade first, and make sure the model we replace
+  // can be retired.
+  if (_fade_model || _pipeline_retired || !_model_loader.can_retire()) return;
+  EnvModel* next = _model_loader.take_pending();
+  if (next == nullptr) return;
+  if (_model && _config.model_crossfade_blocks > 0) {
+    _fade_model.reset(_model.release());
+    std::swap(_control_rate, _fade_control_rate);
+    _fade_pos = 0;
+  } else if (_pipelined) {
+    retirePipelinedModel(_model.release());
+  } else {
+    _model_loader.retire(_model.release());
+  }
+  _model.reset(next);
+  _control_rate.reset();
+  if (_model->contains_patch()) _fmsynth->load_dx7_config(_model->get_patch());
+}
+
+/**
+adoptPendingFMSettings(): Applies the FM settings of the last apply_config.
+Skipped for this block if the message thread is writing them.
+*/
+void BesselsProcessor::adoptPendingFMSettings() {
+  const juce::SpinLock::ScopedTryLockType lock(_pending_fm_lock);
+  if (!lock.isLocked() || !_pending_fm_set) return;
+  _fmsynth->set_config(_pending_fm.config);
+  _fmsynth->set_ratios(_pending_fm.coarse, _pending_fm.fine);
+  _pending_fm_set = false;
+}
+
+// Defers the retirement of a model the pipeline may still be running.
+void BesselsProcessor::retirePipelinedModel(EnvModel* model) {
+  if (model == nullptr) return;
+  _pipeline_retired = model;
+  _pipeline_retired_index = _pipeline_index - 1;
+}
+
+/**
+pushPipelineFrames(): Queues the features of the host block for the
+inference worker, with the models (and crossfade weight) to run them with.
+*/
+void BesselsProcessor::pushPipelineFrames() {
+  const int n_blocks = _config.num_fmblocks;
+  const int fade_len = std::max(_config.model_crossfade_blocks, 1);
+  const bool run_model = _model && _config.skipInference == false;
+  for (int fmblock = 0; fmblock < n_blocks; fmblock++) {
+    PipelineFrame frame;
+    frame.index = _pipeline_index++;
+    frame.pitch = _block_pitch[fmblock];
+    frame.loudness = _block_rms[fmblock];
+    frame.reset = (_config.allow_model_reset && _block_rms[fmblock] <= 0.0 &&
+                   _block_pitch[fmblock] <= 0.0) ||
+                  (_pipeline_woke && fmblock == 0);
+    if (run_model) {
+      frame.model = _model.get();
+      frame.fade_model = _fade_model.get();
+      if (_fade_model)
+        frame.fade_alpha = std::min(1.0f, (float)(++_fade_pos) / fade_len);
+    }
+    _pipeline.push(frame);  // A dropped frame is extrapolated on render
+  }
+  if (_fade_model && _fade_pos >= fade_len)
+    retirePipelinedModel(_fade_model.release());
+}
+
+/**
+collectPipelineEnvelopes(): Fills the envelopes of fmblock with the worker
+result of the frame before it, one fmblock of latency. The host block is one
+fmblock, so that frame was pushed in the previous callback. Extrapolates the
+envelopes if the result is not ready, without waiting for it.
+*/
+void BesselsProcessor::collectPipelineEnvelopes(int fmblock) {
+  // The frame before waking up was silent, enterIdle cleared its envelopes.
+  if (_pipeline_woke) {
+    _pipeline_woke = false;
+    return;
+  }
+  const int64_t index = _pipeline_index - _config.num_fmblocks + fmblock - 1;
+  if (_pipeline.pop(index, _pipeline_ol)) {
+    std::copy(_pipeline_ol.begin(), _pipeline_ol.end(),
+              _block_ol.begin() + fmblock * 6);
+    return;
+  }
+  extrapolateEnvelopes(_block_ol.data(), fmblock, fmblock + 1);
+  _fallback_fmblocks++;
+  _inference_missed = true;
+}
+
+/**
+Idle state: once the input has been silent for _idle_after fmblocks and the
+synth has faded out, processBlock only looks for signal in the input. The
+pitch trackers, the RMS window, the feature register, inference and the
+synth are skipped and the output is silent. _idle_after spans the longest
+analysis window, so their histories hold silence when processing stops,
+as they would if it had gone on.
+
+wakeFromIdle(): Leaves the idle state if an fmblock of input is above
+idle_threshold. The whole host block is then processed, so the fmblock where
+the signal appears is already tracked and rendered.
+*/
+bool BesselsProcessor::wakeFromIdle(const float* input) {
+  const float gain = std::fabs(_config.in_gain);
+  for (int fmblock = 0; fmblock < _config.num_fmblocks; fmblock++) {
+    const float* samples = input + fmblock * fm_block_size;
+    if (peak_level(samples, fm_block_size) * gain <= _config.idle_threshold)
+      continue;
+    _idle = false;
+    _silent_fmblocks = 0;
+    // fmblock 0 is rendered with the frame before it, a silent one. Its
+    // frame resets the model on the worker.
+    _pipeline_woke = _pipelined;
+    return true;
+  }
+  return false;
+}
+
+// enterIdle(): Stops processing. The model restarts from a reset state.
+void BesselsProcessor::enterIdle() {
+  _idle = true;
+  finishCrossfade();
+  // In pipelined mode the worker owns the model, the first frame after
+  // waking up resets it.
+  if (!_pipelined && _model) _model->reset_state();
+  _control_rate.reset();
+  // Envelopes are extrapolated from silence if the first blocks are late.
+  std::fill(_block_ol.begin(), _block_ol.end(), 0.0f);
+  _fm_render_buffer.clear();
+}
+
+// processIdleBlock(): Output and meters of a host block spent idle.
+void BesselsProcessor::processIdleBlock(juce::AudioBuffer<float>& buffer) {
+  _idle_fmblocks += _config.num_fmblocks;
+  finishCrossfade();  // Of a model adopted while idle
+  if (_config.enableAudioPassthrough)
+    buffer.applyGain(0, 0, buffer.getNumSamples(), _config.in_gain);
+  else
+    buffer.clear();
+  updateMeters(0.0f, 0.0f, _fm_render_buffer);
+}
+
+// Ends the crossfade to the current model at once.
+void BesselsProcessor::finishCrossfade() {
+  if (!_fade_model) return;
+  _fade_pos = std::max(_config.model_crossfade_blocks, 1);
+  if (_pipelined)
+    retirePipelinedModel(_fade_model.release());
+  else if (_model_loader.retire(_fade_model.get()))
+    _fade_model.release();
+}
+
 /**
 processBlock(): Rendering function
 
@@ -162,6 +509,15 @@ void BesselsProcessor::processBlock(juce::AudioBuffer<float>& buffer,
   juce::ignoreUnused(midiMessages);
   
   const int input_ch = 0;  // Use Channel 0 as input
+
+  adoptPendingModel();
+  adoptPendingFMSettings();
+
+  _total_fmblocks += _config.num_fmblocks;
+  if (_idle && !wakeFromIdle(buffer.getReadPointer(input_ch))) {
+    processIdleBlock(buffer);
+    return;
+  }
   
   // Compute global f0 for all fmblocks to be synthesized.
   _tracker_manager.updateBuffer(buffer.getReadPointer(input_ch));
@@ -169,6 +525,7 @@ void BesselsProcessor::processBlock(juce::AudioBuffer<float>& buffer,
   float pitch_norm = normalize_pitch(pitch);
 
   // Each fm block renders 64 samples, adapt to the selected plugin block size.
+  /* Step2: Gather control inputs for all fmblocks */
   for(int fmblock = 0; fmblock < _config.num_fmblocks ; fmblock++)
   {
     const int start_sample = fm_block_size*fmblock;
@@ -179,32 +536,33 @@ void BesselsProcessor::processBlock(juce::AudioBuffer<float>& buffer,
     for (auto sample = 0; sample < fm_block_size; sample++) {
       input_read_ptr[sample] = input_read_ptr[sample] * _config.in_gain;
     }
+    if (peak_level(audio_input, fm_block_size) > _config.idle_threshold)
+      _silent_fmblocks = 0;
+    else if (_silent_fmblocks < _idle_after)
+      _silent_fmblocks++;
 
-    /* Step2: Gather control inputs */
     // RMS
     float rms_in = _rms_processor->process(audio_input);
 
     // Run Feature Register
-    rms_in = _feat_register.run(pitch, rms_in);
+    _block_rms[fmblock] = _feat_register.run(pitch, rms_in);
+    _block_pitch[fmblock] = pitch_norm;
+  }
 
-    /* Step3: DNN inference */
+  /* Step3: DNN inference, one call per run of fmblocks between resets */
+  runInference();
 
-    /* DNN Reset logic */
-    if(_config.allow_model_reset)
-      if (rms_in <= 0.0 && pitch_norm <= 0.0)
-        if (_config.skipInference == false && _model) {
-          _model->reset_state();
-        }
-
-    std::vector<float> fm_ol;
-    std::vector<float> fm_ol_placeholder = {1, 0, 0, 0, 0, 0};
-    if (_model && _config.skipInference == false) {
-      fm_ol = _model->call(pitch_norm, rms_in);
-    } else
-      fm_ol = fm_ol_placeholder;
+  for(int fmblock = 0; fmblock < _config.num_fmblocks ; fmblock++)
+  {
+    const int start_sample = fm_block_size*fmblock;
+    const float rms_in = _block_rms[fmblock];
+    if (_pipelined) collectPipelineEnvelopes(fmblock);
+
+    // _fm_ol is preallocated, so nothing here touches the heap.
+    std::vector<float> &fm_ol = _fm_ol;
     // FM Boost
     for (int i = 0; i < 6; i++)
-      fm_ol[i] = fm_ol[i] * _config.fm_boost[i];
+      fm_ol[i] = _block_ol[fmblock * 6 + i] * _config.fm_boost[i];
 
     /* Step4: Render audio */
     float* renderer_buffer = _fmsynth->render(pitch * _config.pitch_ratio, fm_ol);
@@ -219,6 +577,15 @@ void BesselsProcessor::processBlock(juce::AudioBuffer<float>& buffer,
     if(fmblock == _config.num_fmblocks - 1)
       updateMeters(rms_in,pitch,_fm_render_buffer);
   } // end for loop fmblock
+  _pruned_op_samples = (int64_t)_fmsynth->get_pruned_samples();
+  _cycle_samples = (int64_t)_fmsynth->get_cycle_samples();
+  if (_inference_missed) {
+    _inference_misses++;
+    // Check the budget between chunks for a while.
+    _chunked_blocks = _config.inference_chunk_blocks;
+  } else if (_chunked_blocks > 0) {
+    _chunked_blocks--;
+  }
 
   /* Step5: Store audio in JUCE's output buffers. */
   for (int i = 0; i < totalNumOutputChannels; i++) {
@@ -234,6 +601,9 @@ void BesselsProcessor::processBlock(juce::AudioBuffer<float>& buffer,
     }
   }
 
+  if (_idle_after > 0 && _silent_fmblocks >= _idle_after &&
+      _fmsynth->is_silent())
+    enterIdle();
 }
 
 /**
@@ -245,13 +615,69 @@ void BesselsProcessor::prepareToPlay(double sampleRate, int samplesPerBlock) {
   // need..
 
   std::cout << "[DEBUG] prepareToPlay() called!" << std::endl;
+  // OSC Live Debug Module
+  if (!_osc_connected) {
+    _osc_connected = _osc_sender.connect("127.0.0.1", 12000);  // [4]
+    if (_osc_connected)
+      std::cout << "[OSC] Connected: UDP port 12000." << std::endl;
+    else
+      std::cout << "[OSC] Error: could not connect to UDP port 12000."
+                << std::endl;
+  }
   _load_measurer.reset(sampleRate, samplesPerBlock);
+  // Inference budget, a share of the buffer duration the load measurer uses.
+  _inference_budget_ticks =
+      (juce::int64)(_config.inference_budget * samplesPerBlock / sampleRate *
+                    (double)juce::Time::getHighResolutionTicksPerSecond());
+  _chunked_blocks = 0;
+  // Restart the pipeline from an empty ring, frame indices start over.
+  _pipeline.stop();
+  _pipeline_index = 0;
+  _pipeline_retired_index = -1;
+  _pipeline_woke = false;
+  // With longer buffers the frame before an fmblock is pushed in the same
+  // callback, the worker would only move the wait, not remove it.
+  _pipelined =
+      _config.usePipelinedInference && samplesPerBlock <= fm_block_size;
+  if (_config.usePipelinedInference && !_pipelined)
+    std::cout << "[PIPELINE] Runs at " << fm_block_size
+              << "-sample buffers, not " << samplesPerBlock
+              << ", inference stays inline" << std::endl;
+  if (_pipelined) _pipeline.start(_config.pipeline_core);
+  setLatencySamples(_pipelined ? fm_block_size : 0);
 
   _config.num_fmblocks = samplesPerBlock / fm_block_size;
+  _block_pitch.assign(_config.num_fmblocks, 0.0f);
+  _block_rms.assign(_config.num_fmblocks, 0.0f);
+  _block_ol.assign(_config.num_fmblocks * 6, 0.0f);
+  _block_ol_fade.assign(_config.num_fmblocks * 6, 0.0f);
+  _model_loader.set_max_frames(_config.num_fmblocks);
+  _model_loader.set_warmup_steps(_config.model_warmup_steps);
+  // A model published before the block size was known, as when a session is
+  // restored, was sized for shorter blocks. Adopt it while it can be resized.
+  adoptPendingModel();
+  if (_model) _model->prepare_sequence(_config.num_fmblocks);
+  if (_fade_model) _fade_model->prepare_sequence(_config.num_fmblocks);
+  _control_rate_tolerance = _config.control_rate_tolerance;
+  for (AdaptiveControlRate* rate : {&_control_rate, &_fade_control_rate}) {
+    rate->set_tolerance(_control_rate_tolerance);
+    rate->set_max_stride(_config.control_rate_max_stride);
+    rate->prepare(_config.num_fmblocks);
+    rate->reset();
+  }
   _fm_render_buffer.setSize(1,samplesPerBlock);
   /* Init renderer */
   //_feedbackBuffer.resize(samplesPerBlock);
-  if (_fmsynth) _fmsynth->init(sampleRate, fm_block_size);
+  if (_fmsynth) {
+    _fmsynth->init(sampleRate, fm_block_size);
+    // Mastering renders get the exact sine and no cycle cache, live playing
+    // the cheaper ones.
+    const bool exact = _config.fm_exact_offline && isNonRealtime();
+    _fmsynth->set_sine_engine(
+        exact ? FMSineEngine::EXACT : (FMSineEngine)_config.fm_sine_engine);
+    _fmsynth->set_prune_level(_config.fm_prune_level);
+    _fmsynth->set_cycle_tolerance(exact ? -1.0f : _config.fm_cycle_tolerance);
+  }
 
   /* Init RMS processor */
   const int RMS_WINDOW = 2048;
@@ -260,6 +686,15 @@ void BesselsProcessor::prepareToPlay(double sampleRate, int samplesPerBlock) {
                          fm_block_size, // Block size
                          true);         // Linear output
 
+  // Idle once the RMS window, longer than the Yin windows, holds silence.
+  _idle_after = (_config.idle_fmblocks > 0)
+                    ? std::max(_config.idle_fmblocks, RMS_WINDOW / fm_block_size)
+                    : 0;
+  _idle = false;
+  _silent_fmblocks = 0;
+  _total_fmblocks = 0;
+  _idle_fmblocks = 0;
+
   /* Init Pitch Trackers */
   // Minimum f0 detectable: 2*(sr/yinwindow)
   const std::array<int,4> yin_windows = {256,512,1024,1280};
@@ -320,6 +755,11 @@ void BesselsProcessor::changeProgramName(int index, const juce::String& newName)
 void BesselsProcessor::releaseResources() {
   // When playback stops, you can use this as an opportunity to free up any
   // spare memory, etc.
+  _pipeline.stop();
+  if (_total_fmblocks > 0)
+    std::cout << "[IDLE] " << _idle_fmblocks << " of " << _total_fmblocks
+              << " fmblocks idle ("
+              << 100.0 * _idle_fmblocks / _total_fmblocks << "%)" << std::endl;
 }
 
 bool BesselsProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const {
@@ -43,7 +43,12 @@ Plugin Processor Class (BesselsProcessor) declaration
 #include <juce_osc/juce_osc.h>
 
 #include "BinaryData.h"
+#include "Inference/AdaptiveControlRate.hpp"
+#include "Inference/BuiltinBank.hpp"
 #include "Inference/EnvModels.hpp"
+#include "Inference/InferencePipeline.hpp"
+#include "Inference/InferenceThreading.hpp"
+#include "Inference/ModelLoader.hpp"
 #include "FMSynth/FMSynth.hpp"
 #include "FeatureProcessing/FeatureRegister.hpp"
 #include "FeatureProcessing/RMSProcessor.hpp"
@@ -58,7 +63,8 @@ juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
 //==============================================================================
 class BesselsProcessor : public foleys::MagicProcessor,
-                      private juce::AudioProcessorValueTreeState::Listener {
+                      private juce::AudioProcessorValueTreeState::Listener,
+                      private juce::AsyncUpdater {
  public:
   //==============================================================================
   BesselsProcessor();
@@ -85,7 +91,37 @@ class BesselsProcessor : public foleys::MagicProcessor,
   void setCurrentProgram(int index) override;
   const juce::String getProgramName(int index) override;
   void changeProgramName(int index, const juce::String& newName) override;
-  void sendDebugMessages(int fmblock, float pitch, float pitch_norm, float rms_in, std::vector<float> fm_ol);
+  void runInference();
+  void runModel(EnvModel& model, AdaptiveControlRate& rate, float* block_ol);
+  void runSequence(EnvModel& model, AdaptiveControlRate& rate, float* block_ol,
+                   int start, int end);
+  void extrapolateEnvelopes(float* block_ol, int start, int end);
+  void crossfadeEnvelopes();
+  void pushPipelineFrames();
+  void collectPipelineEnvelopes(int fmblock);
+  void retirePipelinedModel(EnvModel* model);
+  void adoptPendingModel();
+  void adoptPendingFMSettings();
+  bool wakeFromIdle(const float* input);
+  void enterIdle();
+  void processIdleBlock(juce::AudioBuffer<float>& buffer);
+  void finishCrossfade();
+  void handleAsyncUpdate() override;
+  bool has_model() { return _has_model; }
+  bool is_loading_model() { return _model_loader.is_loading(); }
+  // Host blocks that ran out of inference budget, and fmblocks extrapolated.
+  int get_inference_misses() { return _inference_misses; }
+  int get_fallback_fmblocks() { return _fallback_fmblocks; }
+  // Model steps skipped by the adaptive control rate.
+  int get_skipped_steps() { return _skipped_steps; }
+  // FM operator-samples skipped by pruning since prepareToPlay.
+  int64_t get_pruned_op_samples() { return _pruned_op_samples; }
+  // FM samples played from the cycle cache since prepareToPlay.
+  int64_t get_cycle_samples() { return _cycle_samples; }
+  // fmblocks processed since prepareToPlay, and those skipped while idle.
+  int64_t get_total_fmblocks() { return _total_fmblocks; }
+  int64_t get_idle_fmblocks() { return _idle_fmblocks; }
+  void sendDebugMessages(int fmblock, float pitch, float pitch_norm, float rms_in, const std::vector<float>& fm_ol);
   void initialiseBuilder(foleys::MagicGUIBuilder& builder) override;
   void parameterChanged(const juce::String& param, float value) override;
   void postSetStateInformation () override;
@@ -107,7 +143,9 @@ class BesselsProcessor : public foleys::MagicProcessor,
       const std::string& model_filename);  // For standalone gru models
   void load_gru_model(const std::string& model_path, int n_state);
   void apply_config();
-  void reload_model(const unsigned int entry);
+  void reload_model(const unsigned int entry, bool update_knobs = false);
+  // Request with the inference settings of _config.
+  ModelRequest make_model_request(const std::string& model_path, int n_state);
 
 
   /* Application Specific attributes. */
@@ -115,12 +153,21 @@ class BesselsProcessor : public foleys::MagicProcessor,
   juce::AudioBuffer<float> _fm_render_buffer;     // Render buffer
   juce::AudioProcessLoadMeasurer _load_measurer;  // CPU Load measurer
   std::unique_ptr<FMSynth> _fmsynth;              // Synth.
-  std::unique_ptr<EnvModel> _model;               // Resynthesis Model wrapper pointer.
+  std::unique_ptr<EnvModel> _model;               // Resynthesis Model wrapper pointer. Audio thread only.
+  std::unique_ptr<EnvModel> _fade_model;          // Replaced model, kept during the crossfade
+  ModelLoader _model_loader;                      // Loads models on a worker thread
   PitchTrackManager<4> _tracker_manager;          // Pitch tracker manager
   std::unique_ptr<RMS_Processor> _rms_processor;  // RMS Processor
   PluginConfig _config;                           // Config structure
-  juce::OSCSender _osc_sender;                    // OSC IF
+  juce::OSCSender _osc_sender;                    // OSC IF, connected in prepareToPlay
+  bool _osc_connected = false;
   FeatureRegister _feat_register;                 // Feature Register
+  std::vector<float> _fm_ol;                      // Envelopes of current fmblock
+  std::vector<float> _block_pitch;                // Per fmblock model inputs
+  std::vector<float> _block_rms;
+  std::vector<float> _block_ol;                   // Per fmblock envelopes [n x 6]
+  std::vector<float> _block_ol_fade;              // Envelopes of _fade_model
+  int _fade_pos = 0;                              // fmblocks into the crossfade
 
  private:
   
@@ -134,6 +181,46 @@ class BesselsProcessor : public foleys::MagicProcessor,
   foleys::MagicLevelSource* _input_rms_meter{nullptr};
   foleys::MagicLevelSource* _input_f0_meter{nullptr};
   foleys::MagicLevelSource* _output_meter{nullptr};
+  juce::AudioBuffer<float> _meter_buffer;          // Single sample for meters
+  ModelLoadResult _load_result;                    // Last load, for handleAsyncUpdate
+  juce::SpinLock _load_result_lock;
+  // FM settings of apply_config, picked up by processBlock: only the audio
+  // thread changes _fmsynth while it renders.
+  struct FMSettings {
+    unsigned int config = 0;
+    std::array<uint8_t, 6> coarse = {1, 1, 1, 1, 1, 1};
+    std::array<uint8_t, 6> fine = {0};
+  };
+  FMSettings _pending_fm;
+  bool _pending_fm_set = false;
+  juce::SpinLock _pending_fm_lock;
+  std::atomic<bool> _has_model{false};
+  std::atomic<bool> _update_knobs_on_load{false};
+  juce::int64 _inference_budget_ticks = 0;         // 0 disables the deadline
+  juce::int64 _inference_start = 0;                // Ticks at runInference()
+  bool _inference_late = false;                    // Budget spent this block
+  bool _inference_missed = false;                  // Overran or extrapolated
+  int _chunked_blocks = 0;                         // Host blocks left to chunk
+  std::atomic<int> _inference_misses{0};
+  std::atomic<int> _fallback_fmblocks{0};
+  AdaptiveControlRate _control_rate;               // Step gating of _model
+  AdaptiveControlRate _fade_control_rate;          // Step gating of _fade_model
+  float _control_rate_tolerance = 0.0f;            // Tolerance they run with
+  std::atomic<int> _skipped_steps{0};
+  std::atomic<int64_t> _pruned_op_samples{0};
+  std::atomic<int64_t> _cycle_samples{0};
+  bool _idle = false;                              // Input silent, processing stopped
+  int _silent_fmblocks = 0;                        // Silent fmblocks in a row
+  int _idle_after = 0;                             // fmblocks before idling, 0 = never
+  std::atomic<int64_t> _total_fmblocks{0};
+  std::atomic<int64_t> _idle_fmblocks{0};
+  InferencePipeline _pipeline;                     // Inference worker, pipelined mode
+  bool _pipelined = false;                         // Set in prepareToPlay
+  int64_t _pipeline_index = 0;                     // Next frame to push
+  std::array<float, 6> _pipeline_ol = {0};
+  bool _pipeline_woke = false;                     // First block after idle
+  EnvModel* _pipeline_retired = nullptr;           // Replaced, maybe still in use
+  int64_t _pipeline_retired_index = -1;            // Last frame pushed with it
   juce::LookAndFeel_V1 plotLookAndFeel;
   //==============================================================================
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BesselsProcessor)
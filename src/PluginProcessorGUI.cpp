@@ -38,6 +38,7 @@ Implements GUI methods within foleys::MagicProcessor plugin class.
 #include <cmath>
 
 #include "GuiItems/GuiItems.hpp"
+#include "Inference/ModelIndex.hpp"
 #include "PluginProcessor.hpp"
 
 /**
@@ -151,19 +152,18 @@ void BesselsProcessor::storeToValTree(juce::Identifier child_id,
 void BesselsProcessor::updateMeters(float rms_in, float pitch, 
   juce::AudioBuffer<float> &buffer)
 {
+  // _meter_buffer is preallocated, this runs on the audio thread.
   if (_input_rms_meter)
     {
-      auto input_buffer = juce::AudioBuffer<float>(1,1);
       //Denormalize rms before feeding into meter
-      input_buffer.getWritePointer(0)[0] = powf(20,((rms_in-1.33f)*60.0f)/20.0f);
-      _input_rms_meter->pushSamples(input_buffer);
+      _meter_buffer.getWritePointer(0)[0] = powf(20,((rms_in-1.33f)*60.0f)/20.0f);
+      _input_rms_meter->pushSamples(_meter_buffer);
     }
   if (_input_f0_meter)
     {
-      auto input_buffer = juce::AudioBuffer<float>(1,1);
       // Scale pitch for feeding into meter
-      input_buffer.getWritePointer(0)[0] = pitch > 3000? 1.0 : pitch/3000 ;
-      _input_f0_meter->pushSamples(input_buffer);
+      _meter_buffer.getWritePointer(0)[0] = pitch > 3000? 1.0 : pitch/3000 ;
+      _input_f0_meter->pushSamples(_meter_buffer);
     }
   if (_output_meter) _output_meter->pushSamples(buffer);
 
@@ -205,12 +205,13 @@ void BesselsProcessor::showLoadDialog() {
           juce::FileBrowserComponent::canSelectDirectories |
           juce::FileBrowserComponent::canSelectFiles,
       juce::File(guiconfig->modeldir),
-      std::make_unique<juce::WildcardFileFilter>("*.ts", "*",
+      std::make_unique<juce::WildcardFileFilter>("*.ts;*.btm", "*",
                                                  NEEDS_TRANS("Model Files")));
   dialog->setAcceptFunction([&, dlg = dialog.get(), guiconfig] {
     auto file = dlg->getFile();
     std::cout << "File: " << file.getFullPathName() << std::endl;
-    if (file.getFileExtension().toStdString() == ".ts")
+    if (file.getFileExtension().toStdString() == ".ts" ||
+        file.getFileExtension().toStdString() == FLAT_MODEL_EXTENSION)
       guiconfig->modeldir =
           file.getParentDirectory().getFullPathName().toStdString();
     else
@@ -230,7 +231,25 @@ void BesselsProcessor::showLoadDialog() {
   builder_ptr->showOverlayDialog(std::move(dialog));
   return;
 }
-// Assumes a hidden GRU state of 128 for all models
+// Model index of a directory: stored beside the models, or in the user
+// application data folder if the directory is read only.
+static juce::File getModelIndexFile(const juce::File& dir) {
+  if (dir.hasWriteAccess()) return dir.getChildFile(".besselstrick-index");
+  auto cache_dir = juce::File::getSpecialLocation(
+                       juce::File::userApplicationDataDirectory)
+                       .getChildFile("BesselsTrick")
+                       .getChildFile("ModelIndex");
+  cache_dir.createDirectory();
+  return cache_dir.getChildFile(
+      juce::String::toHexString(dir.getFullPathName().hashCode64()) +
+      ".index");
+}
+
+// State sizes come from the model index, only new or changed models are
+// probed. Models the index can not read are assumed to have a hidden GRU
+// state of 128.
+// Flat .btm models are listed in place of a .ts of the same name.
+// Built-in models (see BuiltinBank.hpp) are listed after the directory.
 void BesselsProcessor::loadModelList() {
   auto *guiconfig = magicState.getObjectWithType<PluginGUIConfig>("guiconfig");
   if(!guiconfig) return;
@@ -238,13 +257,34 @@ void BesselsProcessor::loadModelList() {
   guiconfig->modelnames.clear();
   guiconfig->nstates.clear();
   juce::File f(guiconfig->modeldir);
-  auto modelList = f.findChildFiles(2, false, "*.ts");
+  auto modelList = f.findChildFiles(2, false, "*.ts;*.btm");
+  modelList.sort();
   for (juce::File& file : modelList) {
+    if (file.hasFileExtension(".ts") &&
+        file.withFileExtension(FLAT_MODEL_EXTENSION).existsAsFile())
+      continue;
     std::cout << " Listed " << file.getFileName() << std::endl;
     guiconfig->modelfilenames.push_back(file.getFileName().toStdString());
     guiconfig->modelnames.push_back(
         file.getFileNameWithoutExtension().toStdString());
-    guiconfig->nstates.push_back(128);
+  }
+  if (!guiconfig->modelfilenames.empty()) {
+    ModelIndex index;
+    index.load(getModelIndexFile(f).getFullPathName().toStdString());
+    if (index.update(guiconfig->modeldir, guiconfig->modelfilenames) > 0 &&
+        !index.save())
+      std::cout << "[MODEL INDEX] Could not save the index of "
+                << guiconfig->modeldir << std::endl;
+    for (const auto& filename : guiconfig->modelfilenames) {
+      const ModelIndexEntry* entry = index.find(filename);
+      guiconfig->nstates.push_back(
+          (entry && entry->n_state > 0) ? entry->n_state : 128);
+    }
+  }
+  for (const BuiltinModel* model : builtin_models()) {
+    guiconfig->modelfilenames.push_back(builtin_model_path(*model));
+    guiconfig->modelnames.push_back(std::string(model->name) + " (built-in)");
+    guiconfig->nstates.push_back(model->hidden);
   }
 }
 
@@ -331,6 +371,8 @@ juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout() {
           juce::ParameterID(IDs::debug2, 1), "Bypass Inference", 0, 1, 0),
       std::make_unique<juce::AudioParameterInt>(
           juce::ParameterID(IDs::debug3, 1), "Audio Passthrough", 0, 1, 0),
+      std::make_unique<juce::AudioParameterInt>(
+          juce::ParameterID(IDs::debug4, 1), "Native Inference", 0, 1, 1),
       std::make_unique<juce::AudioParameterInt>(
           juce::ParameterID(IDs::debug5, 1), "Halve Pitch", 0, 1, 0),
       std::make_unique<juce::AudioParameterInt>(
@@ -341,9 +383,26 @@ juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout() {
           juce::ParameterID(IDs::debug8, 1), "Enable FeatReg", 0, 1, 1), //Should be engaged by default.
       std::make_unique<juce::AudioParameterInt>(
           juce::ParameterID(IDs::debug9, 1), "FeatReg Mode", 0, 1, 0)); //Default mode: SYNC
+
+  // libtorch pools are sized once per process, by the first model loaded.
+  // Pipelined inference changes the latency, it applies on prepareToPlay.
+  auto inference = std::make_unique<juce::AudioProcessorParameterGroup>(
+      "Inference", TRANS("Inference"), "|");
+  inference->addChild(
+      std::make_unique<juce::AudioParameterInt>(
+          juce::ParameterID(IDs::torchIntraOp, 1), "Intra-op Threads", 0, 16, 1),
+      std::make_unique<juce::AudioParameterInt>(
+          juce::ParameterID(IDs::torchInterOp, 1), "Inter-op Threads", 0, 16, 1),
+      std::make_unique<juce::AudioParameterFloat>(
+          juce::ParameterID(IDs::controlRateTolerance, 1),
+          "Control Rate Tolerance",
+          juce::NormalisableRange<float>(0.0f, 0.1f, 0.001f), 0.0f),
+      std::make_unique<juce::AudioParameterInt>(
+          juce::ParameterID(IDs::pipelinedInference, 1), "Pipelined Inference", 0, 1, 0));
   
   layout.add(std::move(algorithm), std::move(ratios_dx),
-            std::move(boost), std::move(gain), std::move(debug));
+            std::move(boost), std::move(gain), std::move(debug),
+            std::move(inference));
 
   return layout;
 }
@@ -378,11 +437,17 @@ void BesselsProcessor::configure_gui_listeners() {
   treeState.addParameterListener(IDs::debug1, this);
   treeState.addParameterListener(IDs::debug2, this);
   treeState.addParameterListener(IDs::debug3, this);
+  treeState.addParameterListener(IDs::debug4, this);
   treeState.addParameterListener(IDs::debug5, this);
   treeState.addParameterListener(IDs::debug6, this);
   treeState.addParameterListener(IDs::debug7, this);
   treeState.addParameterListener(IDs::debug8, this);
   treeState.addParameterListener(IDs::debug9, this);
+
+  treeState.addParameterListener(IDs::torchIntraOp, this);
+  treeState.addParameterListener(IDs::torchInterOp, this);
+  treeState.addParameterListener(IDs::controlRateTolerance, this);
+  treeState.addParameterListener(IDs::pipelinedInference, this);
 }
 
 void BesselsProcessor::parameterChanged(const juce::String& param, float value) {
@@ -425,6 +490,8 @@ void BesselsProcessor::parameterChanged(const juce::String& param, float value)
     _config.skipInference = (value != 0.0f);
   else if (param == IDs::debug3)
     _config.enableAudioPassthrough = (value != 0.0f);
+  else if (param == IDs::debug4)
+    _config.useNativeInference = (value != 0.0f);
   else if (param == IDs::debug5)
     _config.pitch_ratio = (value == 0.0f) ? 1.0f : 0.5f;
   else if (param == IDs::debug6)
@@ -438,6 +505,15 @@ void BesselsProcessor::parameterChanged(const juce::String& param, float value)
                                 : FeatureRegister::WorkingMode::LATCH;
     _feat_register.setMode(mode);
   }
+  // Inference Configuration
+  else if (param == IDs::torchIntraOp)
+    _config.torch_intraop_threads = (int)value;
+  else if (param == IDs::torchInterOp)
+    _config.torch_interop_threads = (int)value;
+  else if (param == IDs::controlRateTolerance)
+    _config.control_rate_tolerance = value;
+  else if (param == IDs::pipelinedInference)
+    _config.usePipelinedInference = (value != 0.0f);
   apply_config();
   updateGuiConfig();
   return;
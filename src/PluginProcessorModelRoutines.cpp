@@ -38,32 +38,51 @@ Plugin routines for switching models and modifying FM patches
 
 #include "PluginProcessor.hpp"
 
+// The synth takes the FM settings at the start of the next block (see
+// adoptPendingFMSettings).
 void BesselsProcessor::apply_config() {
-  _fmsynth->set_config(_config.fm_config);
-  _fmsynth->set_ratios(_config.fm_coarse,_config.fm_fine);
+  {
+    const juce::SpinLock::ScopedLockType lock(_pending_fm_lock);
+    _pending_fm.config = _config.fm_config;
+    _pending_fm.coarse = _config.fm_coarse;
+    _pending_fm.fine = _config.fm_fine;
+    _pending_fm_set = true;
+  }
   //_pitch_tracker->setThreshold(_config.yin_threshold);
   _tracker_manager.setThreshold(_config.yin_threshold);
 }
 
-void BesselsProcessor::reload_model(const unsigned int entry) {
+void BesselsProcessor::reload_model(const unsigned int entry,
+                                    bool update_knobs) {
   auto *guiconfig = magicState.getObjectWithType<PluginGUIConfig>("guiconfig");
   if(!guiconfig) return;
 
   // Ensure entry is within range
-  if(entry > guiconfig->modelnames.size()) return;
+  if(entry >= guiconfig->modelnames.size()) return;
   std::cout << "BesselsProcessor::reload_model() -  Loading "
             << (guiconfig->modelnames)[entry]
             << "  - state: " << guiconfig->nstates[entry] << std::endl;
 
-  load_gru_model((guiconfig->modeldir) + "/" + guiconfig->modelfilenames[entry], guiconfig->nstates[entry]);
+  // Built-in models are listed by their path.
+  auto model_path = [guiconfig](int idx) {
+    const std::string& filename = guiconfig->modelfilenames[idx];
+    return is_builtin_model(filename) ? filename
+                                      : guiconfig->modeldir + "/" + filename;
+  };
+  _update_knobs_on_load = update_knobs;
+  load_gru_model(model_path(entry), guiconfig->nstates[entry]);
 
-  std::cout << "\tContains patch:" << _model->contains_patch() << std::endl;
-  if (_model->contains_patch()) {
-    _fmsynth->load_dx7_config(_model->get_patch());
-    _config.fm_config = _fmsynth->get_config();
-    _config.fm_coarse = _fmsynth->get_fr_coarse();
-    _config.fm_fine = _fmsynth->get_fr_fine();
-  }
+  // Warm up the cache with the entries next to the selection, the ones
+  // most likely to be picked next.
+  std::vector<ModelRequest> neighbours;
+  const int n_entries = (int)guiconfig->modelnames.size();
+  for (int d = 1; d <= _config.model_prefetch_radius; d++)
+    for (int idx : {(int)entry + d, (int)entry - d}) {
+      if (idx < 0 || idx >= n_entries) continue;
+      neighbours.push_back(
+          make_model_request(model_path(idx), guiconfig->nstates[idx]));
+    }
+  _model_loader.prefetch(neighbours);
 }
 
 // Load a standalone gru model
@@ -72,18 +91,51 @@ void BesselsProcessor::load_gru_model(const std::string& model_path) {
                  0);  // Hidden size not specified for standalone model.
 }
 
+// Returns immediately. The model is loaded and warmed up by _model_loader and
+// picked up by processBlock, which applies its patch. handleAsyncUpdate shows
+// the patch on the knobs.
 void BesselsProcessor::load_gru_model(const std::string& model_path,
                                    int n_state) {
   std::cout << " load_gru_model() " << model_path << " "
             << n_state << std::endl;
-  bool old_skip_switch_val = _config.skipInference;
-  _config.skipInference = true;  // Override config value
-  _model.reset(new GRUModel());
+  _model_loader.request(make_model_request(model_path, n_state));
+}
+
+ModelRequest BesselsProcessor::make_model_request(const std::string& model_path,
+                                                  int n_state) {
+  ModelRequest request;
+  request.path = model_path;
+  request.n_state = n_state;
+  request.prefer_native = _config.useNativeInference;
+  request.torch_optimization = (TorchOptimization)_config.torch_optimization;
+  request.torch_executor = (TorchExecutor)_config.torch_executor;
+  // Applied once per process, by the first libtorch model.
+  request.thread_policy.intra_op_threads = _config.torch_intraop_threads;
+  request.thread_policy.inter_op_threads = _config.torch_interop_threads;
+  return request;
+}
 
-  std::array<int, 3> model_input_sizes = {1, 1, 2};
-  constexpr int n_outputs = 6;
-  // Init for GRUModel
-  _model->init(model_path, model_input_sizes,
-               n_outputs, n_state);
-  _config.skipInference = old_skip_switch_val;
-}
\ No newline at end of file
+// Runs on the message thread once the loader thread finished a model. The
+// audio thread applies the patch when it adopts the model, this only reads it
+// into _config.
+void BesselsProcessor::handleAsyncUpdate() {
+  ModelLoadResult result;
+  {
+    const juce::SpinLock::ScopedLockType lock(_load_result_lock);
+    result = _load_result;
+  }
+  if (result.loaded) {
+    _has_model = true;
+    std::cout << "\tContains patch:" << result.contains_patch << std::endl;
+    if (result.contains_patch) {
+      FMSynth::read_dx7_config(result.patch, _config.fm_config,
+                               _config.fm_coarse, _config.fm_fine);
+      std::cout << "\t alg: " << _config.fm_config << std::endl;
+      if (_update_knobs_on_load && builder_ptr) updateKnobs();
+    }
+  }
+  _update_knobs_on_load = false;
+  if (builder_ptr)
+    if (auto* status_label = builder_ptr->findGuiItemWithId(GUI_IDs::status))
+      status_label->update();
+}
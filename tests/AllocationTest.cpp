@@ -0,0 +1,420 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+/*
+File: AllocationTest.cpp
+Checks that processBlock does not touch the heap.
+
+Usage:
+    BesselsTrickAllocationTest <model> <model>
+
+Runs the plugin processor headless, the way a host does: it is created,
+prepared and fed host blocks of a sine performance (notes with vibrato,
+releases and silences long enough to go idle) through processBlock, while
+its model loader and inference worker run on their own threads. Global
+operator new and delete are replaced with versions that count the calls
+made by the thread calling processBlock. Any allocation or free in a
+measured block fails the test.
+
+Every scene plays the performance after a prepareToPlay with its own
+settings, all on the native engine:
+- restore: the first model loads before prepareToPlay, as when a session
+  is restored. New FM settings and a control rate tolerance are applied
+  while playing.
+- switch: the second model replaces the first with a crossfade, and the
+  first is requested again and published before that crossfade ends.
+- budget: an inference budget no block can meet, so inference is chunked
+  and envelopes are extrapolated.
+- pipelined: 64-sample buffers with the inference worker, switching models
+  while playing.
+
+The debug output is turned off: juce::OSCMessage and the console output
+allocate, and are meant for development only. Neither are calls to malloc
+that bypass operator new counted.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "../src/PluginProcessor.hpp"
+
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter();
+
+namespace {
+
+// Counted on the thread that plays the blocks only. The model loader, the
+// inference worker and JUCE allocate on their own threads, as they may.
+thread_local bool t_counting = false;
+thread_local long t_allocations = 0;
+thread_local long t_frees = 0;
+
+void *counted_alloc(std::size_t size, std::size_t align) {
+  if (t_counting) t_allocations++;
+  if (size == 0) size = 1;
+  void *p = nullptr;
+#if defined(_WIN32)
+  p = (align > alignof(std::max_align_t)) ? _aligned_malloc(size, align)
+                                          : std::malloc(size);
+#else
+  if (align > alignof(std::max_align_t)) {
+    if (posix_memalign(&p, align, size) != 0) p = nullptr;
+  } else {
+    p = std::malloc(size);
+  }
+#endif
+  return p;
+}
+
+void counted_free(void *p, std::size_t align) {
+  if (p == nullptr) return;
+  if (t_counting) t_frees++;
+#if defined(_WIN32)
+  if (align > alignof(std::max_align_t)) {
+    _aligned_free(p);
+    return;
+  }
+#endif
+  (void)align;
+  std::free(p);
+}
+
+void *throwing_alloc(std::size_t size, std::size_t align) {
+  void *p = counted_alloc(size, align);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+constexpr std::size_t kDefaultAlign = alignof(std::max_align_t);
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  return throwing_alloc(size, kDefaultAlign);
+}
+void *operator new[](std::size_t size) {
+  return throwing_alloc(size, kDefaultAlign);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size, kDefaultAlign);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size, kDefaultAlign);
+}
+void *operator new(std::size_t size, std::align_val_t align) {
+  return throwing_alloc(size, (std::size_t)align);
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return throwing_alloc(size, (std::size_t)align);
+}
+void operator delete(void *p) noexcept { counted_free(p, kDefaultAlign); }
+void operator delete[](void *p) noexcept { counted_free(p, kDefaultAlign); }
+void operator delete(void *p, std::size_t) noexcept {
+  counted_free(p, kDefaultAlign);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+  counted_free(p, kDefaultAlign);
+}
+void operator delete(void *p, std::align_val_t align) noexcept {
+  counted_free(p, (std::size_t)align);
+}
+void operator delete[](void *p, std::align_val_t align) noexcept {
+  counted_free(p, (std::size_t)align);
+}
+void operator delete(void *p, std::size_t, std::align_val_t align) noexcept {
+  counted_free(p, (std::size_t)align);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t align) noexcept {
+  counted_free(p, (std::size_t)align);
+}
+
+namespace {
+
+constexpr double kSampleRate = 44100.0;
+constexpr int kFMBlockSize = 64;
+constexpr int kNoteBlocks = 600;                   // fmblocks per note
+constexpr int kPerformanceBlocks = 5 * kNoteBlocks;
+constexpr auto kTimeout = std::chrono::seconds(60);
+
+// Models published by the loader, counted from its on_loaded callback.
+std::atomic<int> g_loads{0};
+std::atomic<bool> g_load_failed{false};
+
+/*
+  Pitch (Hz) and loudness of fmblock t of the performance: notes with
+  vibrato, a held part, a release and a silence long enough to go idle.
+*/
+void performance(int t, float &pitch, float &loudness) {
+  const int note = t / kNoteBlocks;
+  const int pos = t % kNoteBlocks;
+  pitch = 110.0f * std::pow(2.0f, (float)((note * 5) % 24) / 12.0f) *
+          (1.0f + 0.003f * std::sin(0.05f * (float)t));
+  if (pos < 30)
+    loudness = 0.5f * (float)pos / 30.0f;
+  else if (pos < 400)
+    loudness = 0.5f;
+  else if (pos < 450)
+    loudness = 0.5f * (float)(450 - pos) / 50.0f;
+  else
+    loudness = 0.0f;
+}
+
+// Heap calls made by the blocks of one scene.
+struct Section {
+  std::string name;
+  long allocations = 0;
+  long frees = 0;
+};
+
+// Plays the performance through processBlock, one host block at a time.
+class Player {
+ public:
+  Player(BesselsProcessor &processor, int block_size)
+      : _processor(processor),
+        _block_size(block_size),
+        _buffer(std::max({processor.getTotalNumInputChannels(),
+                          processor.getTotalNumOutputChannels(), 1}),
+                block_size) {}
+
+  void play_block(Section &section) {
+    _buffer.clear();
+    float *input = _buffer.getWritePointer(0);
+    for (int start = 0; start < _block_size; start += kFMBlockSize) {
+      float pitch, loudness;
+      performance(_t++, pitch, loudness);
+      const float step = 2.0f * juce::MathConstants<float>::pi * pitch /
+                         (float)kSampleRate;
+      for (int s = start; s < start + kFMBlockSize; s++) {
+        input[s] = loudness * std::sin(_phase);
+        _phase = std::fmod(_phase + step, 2.0f * juce::MathConstants<float>::pi);
+      }
+    }
+    const long allocations = t_allocations;
+    const long frees = t_frees;
+    t_counting = true;
+    _processor.processBlock(_buffer, _midi);
+    t_counting = false;
+    section.allocations += t_allocations - allocations;
+    section.frees += t_frees - frees;
+  }
+
+  // Plays n fmblocks, rounded up to whole host blocks.
+  void play(Section &section, int n_fmblocks) {
+    const int end = _t + n_fmblocks;
+    while (_t < end) play_block(section);
+  }
+
+  // Plays until the next note starts, then into its held part.
+  void play_into_note(Section &section) {
+    while (_t % kNoteBlocks != 0) play_block(section);
+    play(section, 60);
+  }
+
+  // Plays until done() holds. False on timeout.
+  template <typename F>
+  bool play_until(Section &section, F &&done) {
+    const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (!done()) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      play_block(section);
+    }
+    return true;
+  }
+
+ private:
+  BesselsProcessor &_processor;
+  const int _block_size;
+  juce::AudioBuffer<float> _buffer;
+  juce::MidiBuffer _midi;
+  int _t = 0;  // fmblocks played
+  float _phase = 0.0f;
+};
+
+// Requests a model, returns the load count once it is published.
+int request(BesselsProcessor &processor, const std::string &path) {
+  const int target = g_loads.load() + 1;
+  processor.load_gru_model(path);
+  return target;
+}
+
+bool loaded(int target) { return g_loads.load() >= target; }
+
+// Waits for the loader without playing, so the model is still pending on the
+// next block.
+bool wait_for_load(int target) {
+  const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (!loaded(target)) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return !g_load_failed;
+}
+
+bool is_native(const EnvModel *model) {
+  return dynamic_cast<const NativeGRUModel *>(model) != nullptr;
+}
+
+// Reports a scene, and what it failed to play.
+bool report(const Section &section, bool played, const char *what) {
+  const bool clean = section.allocations == 0 && section.frees == 0;
+  std::cout << "[ALLOCATION TEST] " << section.name << ": "
+            << section.allocations << " allocations, " << section.frees
+            << " frees" << (clean ? "" : "  FAILED") << std::endl;
+  if (!played)
+    std::cout << "[ALLOCATION TEST] " << section.name << ": " << what
+              << "  FAILED" << std::endl;
+  return clean && played;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <model> <model>" << std::endl;
+    return 2;
+  }
+  const std::string first = argv[1];
+  const std::string second = argv[2];
+  // Hosts create plugins on the message thread.
+  juce::ScopedJuceInitialiser_GUI juce_init;
+  std::unique_ptr<BesselsProcessor> processor(
+      static_cast<BesselsProcessor *>(createPluginFilter()));
+  PluginConfig &config = processor->_config;
+  config.enableOSCOutput = false;
+  config.enableConsoleOutput = false;
+  config.useNativeInference = true;
+  config.usePipelinedInference = false;
+  config.control_rate_tolerance = 0.0f;
+  // Nothing is loaded before the first request, the loader thread does not
+  // run yet.
+  auto forward = processor->_model_loader.on_loaded;
+  processor->_model_loader.on_loaded = [forward](const ModelLoadResult &result) {
+    if (forward) forward(result);
+    if (!result.loaded) g_load_failed = true;
+    g_loads++;
+  };
+  bool ok = true;
+
+  {
+    Section section{"restore"};
+    const int target = request(*processor, first);
+    if (!wait_for_load(target)) {
+      std::cerr << "[ALLOCATION TEST] Could not load " << first << std::endl;
+      return 1;
+    }
+    processor->prepareToPlay(kSampleRate, 512);
+    Player player(*processor, 512);
+    const int64_t idle = processor->get_idle_fmblocks();
+    player.play(section, kPerformanceBlocks / 2);
+    config.control_rate_tolerance = 0.01f;
+    config.fm_coarse[0] = 2;
+    processor->apply_config();
+    player.play(section, kPerformanceBlocks / 2);
+    config.control_rate_tolerance = 0.0f;
+    ok = report(section,
+                is_native(processor->_model.get()) &&
+                    processor->get_idle_fmblocks() > idle,
+                "no native model adopted, or never idle") &&
+         ok;
+  }
+
+  {
+    Section section{"switch"};
+    config.model_crossfade_blocks = 64;
+    processor->prepareToPlay(kSampleRate, 512);
+    Player player(*processor, 512);
+    player.play_into_note(section);
+    const EnvModel *replaced = processor->_model.get();
+    bool played = wait_for_load(request(*processor, second));
+    player.play(section, 16);
+    const EnvModel *adopted = processor->_model.get();
+    played = played && adopted != replaced && processor->_fade_model;
+    // Published while the crossfade runs, adopted once it is done.
+    played = played && wait_for_load(request(*processor, first));
+    player.play(section, kPerformanceBlocks);
+    played = played && processor->_model.get() != adopted &&
+             is_native(processor->_model.get());
+    config.model_crossfade_blocks = 4;
+    ok = report(section, played,
+                "no switch during a crossfade to a native model") &&
+         ok;
+  }
+
+  {
+    Section section{"budget"};
+    config.inference_budget = 1e-4f;
+    processor->prepareToPlay(kSampleRate, 512);
+    Player player(*processor, 512);
+    const int misses = processor->get_inference_misses();
+    player.play(section, kPerformanceBlocks);
+    config.inference_budget = 0.5f;
+    ok = report(section, processor->get_inference_misses() > misses,
+                "the budget was never missed") &&
+         ok;
+  }
+
+  {
+    Section section{"pipelined"};
+    config.usePipelinedInference = true;
+    config.model_crossfade_blocks = 16;
+    processor->prepareToPlay(kSampleRate, kFMBlockSize);
+    Player player(*processor, kFMBlockSize);
+    const int64_t idle = processor->get_idle_fmblocks();
+    player.play_into_note(section);
+    // Loads while playing.
+    const EnvModel *replaced = processor->_model.get();
+    const int target = request(*processor, second);
+    bool played = player.play_until(section, [&] {
+      return loaded(target) && processor->_model.get() != replaced;
+    });
+    played = played && wait_for_load(request(*processor, first));
+    player.play(section, kPerformanceBlocks);
+    played = played && is_native(processor->_model.get()) &&
+             processor->getLatencySamples() == kFMBlockSize &&
+             processor->get_idle_fmblocks() > idle;
+    ok = report(section, played,
+                "no pipelined switch to a native model, or never idle") &&
+         ok;
+  }
+
+  std::cout << "[ALLOCATION TEST] " << (ok ? "passed" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: FMSynthBenchmark.cpp
+Compares the render kernels and the sine engines of FMSynth (see
+FMKernels.hpp).
+
+Usage:
+    BesselsTrickFMBenchmark [options]
+    BesselsTrickFMBenchmark --engines [options]
+    BesselsTrickFMBenchmark --prune <level> [options]
+    BesselsTrickFMBenchmark --cycle <tolerance> [options]
+
+Options:
+    --seconds <s>      Audio rendered per kernel (default 20).
+    --block <samples>  FM block size at 44.1 kHz (default 64).
+
+Every kernel renders the same control sequence through the 32 algorithms:
+pitch glides, output levels that ramp from block to block, and silences. The
+report gives the time per sample, the real-time factor, the speed-up over
+the scalar reference and the largest difference from the reference output.
+Differences are measured block by block, starting each block from the state
+of the reference, so they do not include phase drift. Most of what remains
+is the rounding of the scalar phase accumulator, which the closed-form phases
+of the vector kernels do not have.
+
+--engines compares the sine engines on the default kernel instead, against
+EXACT. It also reports the error of the sine of each engine, rendered by a
+single unmodulated operator over phases the kernel forms exactly.
+
+--prune compares the default kernel with and without operator pruning at
+the given level (the output error pruning may add, see
+FMSynth::set_prune_level), and reports the share of operator-samples
+pruned.
+
+--cycle compares the default kernel with and without the cycle cache at the
+given tolerance (see FMSynth::set_cycle_tolerance), on sustained notes:
+integer ratios, vibrato, and OLs that hold for a second with a slow drift.
+Both synths render the whole sequence, so the difference includes the
+phase drift of the rendered blocks. It also reports the share of samples
+played from the cycle.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/FMSynth/FMSynth.hpp"
+
+namespace {
+
+constexpr float kSampleRate = 44100.0f;
+
+struct Setup {
+  FMRenderKernel kernel;
+  FMSineEngine engine;
+  const char *name;
+  float prune_level = -1.0f;     // Off
+  float cycle_tolerance = -1.0f;  // Off
+};
+
+bool sustained = false;  // --cycle control sequence
+
+const Setup kKernels[] = {
+    {FMRenderKernel::SCALAR, FMSineEngine::POLYNOMIAL, "scalar"},
+    {FMRenderKernel::VECTOR4, FMSineEngine::POLYNOMIAL, "vector4"},
+    {FMRenderKernel::VECTOR8, FMSineEngine::POLYNOMIAL, "vector8"},
+    {FMRenderKernel::VECTOR16, FMSineEngine::POLYNOMIAL, "vector16"},
+};
+
+const Setup kEngines[] = {
+    {FMRenderKernel::VECTOR8, FMSineEngine::EXACT, "exact"},
+    {FMRenderKernel::VECTOR8, FMSineEngine::POLYNOMIAL, "polynomial"},
+    {FMRenderKernel::VECTOR8, FMSineEngine::TABLE, "table"},
+    {FMRenderKernel::VECTOR8, FMSineEngine::PHASOR, "phasor"},
+};
+
+// Pitch and output levels of FM block b. Each operator is silent for about
+// a fifth of the time.
+float control_pitch(long b) {
+  if (sustained)
+    return 220.0f * std::pow(2.0f, (b / 700 % 5) / 12.0f +
+                                       0.01f * std::sin(b * 0.08f));
+  if (b % 700 > 650) return 0.0f;  // Silence, rendered with fades
+  return 110.0f * std::pow(2.0f, 3.0f * (0.5f + 0.5f * std::sin(b * 0.003f)));
+}
+
+void control_ol(long b, std::vector<float> &ol) {
+  if (sustained) {
+    // A new note level every 700 blocks, drifting by 1% over the note.
+    const long note = b / 700;
+    for (int i = 0; i < 6; i++)
+      ol[i] = (0.3f + 0.2f * ((note + i) % 4)) * (1.0f + 1e-5f * (b % 700));
+    return;
+  }
+  for (int i = 0; i < 6; i++)
+    ol[i] = std::max(1.0f + 1.2f * std::sin(b * 0.01f * (i + 1) + i), 0.0f);
+}
+
+void configure(FMSynth &synth, const Setup &setup, int algorithm) {
+  synth.set_render_kernel(setup.kernel);
+  synth.set_sine_engine(setup.engine);
+  synth.set_prune_level(setup.prune_level);
+  synth.set_cycle_tolerance(setup.cycle_tolerance);
+  synth.set_config(algorithm);
+  if (sustained)
+    synth.set_ratios({1, 2, 3, 1, 4, 1}, {0, 0, 0, 0, 0, 0});
+  else
+    synth.set_ratios({1, 2, 3, 1, 4, 7}, {0, 0, 50, 0, 0, 13});
+}
+
+double render_seconds(const Setup &setup, int block_size, long n_blocks,
+                      float &sink, uint64_t &pruned_samples,
+                      uint64_t &cycle_samples) {
+  FMSynth synth;
+  synth.init(kSampleRate, block_size);
+  std::vector<float> ol(6);
+  const long blocks_per_algorithm = std::max(n_blocks / 32, 1L);
+  const auto start = std::chrono::steady_clock::now();
+  for (long b = 0; b < n_blocks; b++) {
+    if (b % blocks_per_algorithm == 0)
+      configure(synth, setup, (int)((b / blocks_per_algorithm) % 32));
+    control_ol(b, ol);
+    const float *out = synth.render(control_pitch(b), ol);
+    sink += out[b % block_size];
+  }
+  pruned_samples = synth.get_pruned_samples();
+  cycle_samples = synth.get_cycle_samples();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+float max_difference(const Setup &setup, const Setup &reference_setup,
+                     int block_size, long n_blocks) {
+  if (sustained) {
+    // The cycle cache needs the history of the note: render continuously.
+    FMSynth synth, reference;
+    synth.init(kSampleRate, block_size);
+    reference.init(kSampleRate, block_size);
+    std::vector<float> ol(6);
+    float max_diff = 0.0f;
+    const long blocks_per_algorithm = std::max(n_blocks / 32, 1L);
+    for (long b = 0; b < n_blocks; b++) {
+      if (b % blocks_per_algorithm == 0) {
+        const int algorithm = (int)((b / blocks_per_algorithm) % 32);
+        configure(synth, setup, algorithm);
+        configure(reference, reference_setup, algorithm);
+      }
+      control_ol(b, ol);
+      const float *out = synth.render(control_pitch(b), ol);
+      const float *ref = reference.render(control_pitch(b), ol);
+      for (int s = 0; s < block_size; s++)
+        max_diff = std::max(max_diff, std::fabs(out[s] - ref[s]));
+    }
+    return max_diff;
+  }
+  FMSynth reference;
+  reference.init(kSampleRate, block_size);
+  std::vector<float> ol(6);
+  float max_diff = 0.0f;
+  for (int algorithm = 0; algorithm < 32; algorithm++) {
+    configure(reference, reference_setup, algorithm);
+    for (long b = 0; b < n_blocks / 32; b++) {
+      control_ol(b, ol);
+      FMSynth synth = reference;
+      synth.set_render_kernel(setup.kernel);
+      synth.set_sine_engine(setup.engine);
+      synth.set_prune_level(setup.prune_level);
+      synth.set_cycle_tolerance(setup.cycle_tolerance);
+      const float *out = synth.render(control_pitch(b), ol);
+      const float *ref = reference.render(control_pitch(b), ol);
+      for (int s = 0; s < block_size; s++)
+        max_diff = std::max(max_diff, std::fabs(out[s] - ref[s]));
+    }
+  }
+  return max_diff;
+}
+
+// Largest error of sin over [0, 2pi). Phases and increments are multiples of
+// 2^-12 below 2pi, so the phases of the block are exact and only the sine
+// engine is measured.
+double sine_error(FMSineEngine engine, int block_size) {
+  // Algorithm 32 has no modulation, OP1 alone is heard.
+  const FMBlockKernel kernel = get_fm_block_kernel(31, 8, engine);
+  const float outmatrix[6] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  std::vector<float> out(block_size);
+  double max_error = 0.0;
+  for (int inc = 1; inc * block_size < 6 * 4096; inc += 3) {
+    for (int start = 0; start + inc * block_size < 6 * 4096; start += 97) {
+      FMRenderState state;
+      state.phase.fill(0.0f);
+      state.phase_inc.fill(0.0f);
+      state.ol.fill(1.0f);
+      state.ol_inc.fill(0.0f);
+      state.phase[0] = start / 4096.0f;
+      state.phase_inc[0] = inc / 4096.0f;
+      kernel(outmatrix, 0x3f, state, out.data(), block_size);
+      for (int s = 0; s < block_size; s++) {
+        const double phase = (start + (double)s * inc) / 4096.0;
+        max_error = std::max(max_error, std::fabs(out[s] - std::sin(phase)));
+      }
+    }
+  }
+  return max_error;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  double seconds = 20.0;
+  int block_size = 64;
+  bool engines = false;
+  bool prune = false;
+  float prune_level = 0.0f;
+  bool cycle = false;
+  float cycle_tolerance = 0.0f;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc)
+      seconds = std::atof(argv[++i]);
+    else if (arg == "--block" && i + 1 < argc)
+      block_size = std::max(std::atoi(argv[++i]), 1);
+    else if (arg == "--engines")
+      engines = true;
+    else if (arg == "--prune" && i + 1 < argc) {
+      prune = true;
+      prune_level = std::atof(argv[++i]);
+    }
+    else if (arg == "--cycle" && i + 1 < argc) {
+      cycle = true;
+      cycle_tolerance = std::atof(argv[++i]);
+    }
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--engines | --prune level | --cycle tolerance]"
+                << " [--seconds s]"
+                << " [--block samples]"
+                << std::endl;
+      return 1;
+    }
+  }
+  const long n_blocks =
+      std::max((long)(seconds * kSampleRate / block_size), 32L);
+  const double audio_seconds = (double)n_blocks * block_size / kSampleRate;
+
+  std::vector<Setup> setups(std::begin(kKernels), std::end(kKernels));
+  const char *unit = "kernel";
+  if (engines) {
+    setups.assign(std::begin(kEngines), std::end(kEngines));
+    unit = "engine";
+  } else if (prune) {
+    const Setup full = {FMRenderKernel::VECTOR8, FMSineEngine::POLYNOMIAL,
+                        "unpruned"};
+    Setup pruned = full;
+    pruned.name = "pruned";
+    pruned.prune_level = prune_level;
+    setups = {full, pruned};
+    unit = "setup";
+  } else if (cycle) {
+    const Setup rendered = {FMRenderKernel::VECTOR8, FMSineEngine::POLYNOMIAL,
+                            "rendered"};
+    Setup cached = rendered;
+    cached.name = "cycle";
+    cached.cycle_tolerance = cycle_tolerance;
+    setups = {rendered, cached};
+    unit = "setup";
+    sustained = true;
+  }
+  const Setup &reference = setups[0];
+
+  std::cout << "[FM BENCHMARK] " << audio_seconds << " s of audio per "
+            << unit << ", " << block_size << " sample blocks" << std::endl;
+  float sink = 0.0f;
+  double reference_seconds = 0.0;
+  for (const auto &setup : setups) {
+    const bool is_reference = (&setup == &reference);
+    uint64_t pruned_samples = 0;
+    uint64_t cycle_samples = 0;
+    const double elapsed = render_seconds(setup, block_size, n_blocks, sink,
+                                          pruned_samples, cycle_samples);
+    if (is_reference) reference_seconds = elapsed;
+    const float diff =
+        is_reference ? 0.0f
+                     : max_difference(setup, reference, block_size, n_blocks);
+    std::cout << "  " << setup.name << ": "
+              << 1e9 * elapsed / (n_blocks * block_size) << " ns/sample, "
+              << audio_seconds / elapsed << "x real time, "
+              << reference_seconds / elapsed << "x " << reference.name
+              << ", max difference " << diff;
+    if (engines)
+      std::cout << ", sine error " << sine_error(setup.engine, block_size);
+    if (setup.prune_level >= 0.0f)
+      std::cout << ", "
+                << 100.0 * pruned_samples / (6.0 * n_blocks * block_size)
+                << "% of operator-samples pruned";
+    if (setup.cycle_tolerance >= 0.0f)
+      std::cout << ", " << 100.0 * cycle_samples / (n_blocks * block_size)
+                << "% of samples from the cycle";
+    std::cout << std::endl;
+  }
+  if (sink == 12345.0f) std::cout << std::endl;  // Keep the renders alive
+  return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: InstanceBenchmark.cpp
+Runs several envelope models concurrently, the way several plugin instances
+in one host do, and reports how long each host block of inference takes.
+
+Usage:
+    BesselsTrickBenchmark [options] <model>...
+    BesselsTrickBenchmark --startup [--torch] <model>...
+
+Options:
+    -n <instances>     Concurrent instances, one thread each (default 8).
+    --block <samples>  Host block size at 44.1 kHz (default 512).
+    --seconds <s>      Duration of the run (default 10).
+    --intra-op <n>     libtorch threads per forward pass, 0 = default (1).
+    --inter-op <n>     libtorch inter-op pool size, 0 = default (1).
+    --torch            Prefer libtorch over the native engine.
+    --pipeline         Step each instance on its own InferencePipeline worker,
+                       as in pipelined mode (64-sample blocks).
+
+Each instance loads the models round robin and steps one host block of
+frames per block period, sleeping in between like an audio callback. The
+report gives the median, 99th percentile and worst block time of every
+instance, and the number of blocks that took longer than the block period.
+Run it once with the defaults and once with e.g. --intra-op 0 to see what
+the threading policy saves. OMP_WAIT_POLICY=PASSIVE in the environment
+keeps idle OpenMP workers from spinning.
+
+With --pipeline the block time is what the audio thread spends: pushing the
+frame of the block and taking the envelope of the one before, which is
+extrapolated (and counted as a miss) if the worker has not finished it.
+Compare it with the same -n at --block 64 without --pipeline.
+
+--startup times the creation of each model twice: cold, the first model of
+the process, which also sets up the inference runtime the plugin no longer
+sets up on construction, and warm. The plugin logs the time of its own
+construction ([STARTUP] lines), cold and warm, in the host.
+*/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/Inference/InferencePipeline.hpp"
+#include "../src/Inference/ModelLoader.hpp"
+
+struct InstanceStats {
+  std::string path;
+  bool loaded = false;
+  std::vector<double> block_us;  // Inference time of every host block
+  int overruns = 0;
+  int misses = 0;  // Pipelined results not ready in time
+};
+
+// Steps model at real-time pace until stop is set.
+static void run_instance(const std::string &path, bool prefer_native,
+                         const BackendOptions &options, int n_frames,
+                         double period_us, bool pipelined,
+                         std::atomic<bool> &start, std::atomic<bool> &stop,
+                         InstanceStats &stats) {
+  stats.path = path;
+  auto model = create_env_model(path, prefer_native, options);
+  stats.loaded = (model != nullptr);
+  if (!model) return;
+  model->prepare_sequence(n_frames);
+  std::vector<float> pitch(n_frames), loudness(n_frames);
+  std::vector<float> output(n_frames * 6);
+  InferencePipeline pipeline;
+  std::array<float, 6> ol;
+  if (pipelined) pipeline.start(-1);
+  while (!start) std::this_thread::yield();
+
+  using clock = std::chrono::steady_clock;
+  const auto period = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double, std::micro>(period_us));
+  auto deadline = clock::now();
+  for (int block = 0; !stop; block++) {
+    // A slow vibrato on A3 with a tremolo, so the state keeps moving.
+    for (int t = 0; t < n_frames; t++) {
+      const float frame = float(block * n_frames + t);
+      pitch[t] = 220.0f * (1.0f + 0.01f * std::sin(frame * 0.05f));
+      loudness[t] = 1.0f + 0.5f * std::sin(frame * 0.01f);
+    }
+    const auto begin = clock::now();
+    if (pipelined) {
+      PipelineFrame frame;
+      frame.index = block;
+      frame.model = model.get();
+      frame.pitch = pitch[0];
+      frame.loudness = loudness[0];
+      pipeline.push(frame);
+      if (!pipeline.pop(block - 1, ol)) stats.misses++;
+    } else {
+      model->call_sequence(pitch.data(), loudness.data(), n_frames,
+                           output.data());
+    }
+    const std::chrono::duration<double, std::micro> elapsed =
+        clock::now() - begin;
+    stats.block_us.push_back(elapsed.count());
+    if (elapsed.count() > period_us) stats.overruns++;
+    deadline += period;
+    std::this_thread::sleep_until(deadline);
+  }
+  pipeline.stop();
+}
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0.0;
+  const size_t k = std::min(values.size() - 1, size_t(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+static void report(const InstanceStats &stats, int index, double period_us,
+                   bool pipelined) {
+  std::cout << "[BENCHMARK] #" << index << " " << stats.path << ": ";
+  if (!stats.loaded) {
+    std::cout << "could not load" << std::endl;
+    return;
+  }
+  const double worst =
+      stats.block_us.empty()
+          ? 0.0
+          : *std::max_element(stats.block_us.begin(), stats.block_us.end());
+  std::cout << stats.block_us.size() << " blocks, p50 "
+            << percentile(stats.block_us, 0.5) << " us, p99 "
+            << percentile(stats.block_us, 0.99) << " us, max " << worst
+            << " us, over " << period_us << " us: " << stats.overruns
+            << (pipelined ? ", not ready: " + std::to_string(stats.misses) : "")
+            << std::endl;
+}
+
+// Microseconds to create the model in path.
+static long long time_creation(const std::string &path, bool prefer_native,
+                               const BackendOptions &options) {
+  const auto start = std::chrono::steady_clock::now();
+  auto model = create_env_model(path, prefer_native, options);
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return model ? us : -1;
+}
+
+static void startup_report(const std::vector<std::string> &models,
+                           bool prefer_native, const BackendOptions &options) {
+  for (const auto &path : models) {
+    const long long cold = time_creation(path, prefer_native, options);
+    const long long warm = time_creation(path, prefer_native, options);
+    if (cold < 0 || warm < 0) {
+      std::cout << "[BENCHMARK] " << path << ": could not load" << std::endl;
+      continue;
+    }
+    std::cout << "[BENCHMARK] " << path << ": created in " << cold
+              << " us (cold), " << warm << " us (warm)" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  int n_instances = 8;
+  int block_size = 512;
+  double seconds = 10.0;
+  bool prefer_native = true;
+  bool startup = false;
+  bool pipelined = false;
+  BackendOptions options;
+  InferenceThreadPolicy &policy = options.thread_policy;
+  std::vector<std::string> models;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "-n" && has_value)
+      n_instances = std::max(1, std::stoi(argv[++i]));
+    else if (arg == "--block" && has_value)
+      block_size = std::max(64, std::stoi(argv[++i]));
+    else if (arg == "--seconds" && has_value)
+      seconds = std::stod(argv[++i]);
+    else if (arg == "--intra-op" && has_value)
+      policy.intra_op_threads = std::stoi(argv[++i]);
+    else if (arg == "--inter-op" && has_value)
+      policy.inter_op_threads = std::stoi(argv[++i]);
+    else if (arg == "--torch")
+      prefer_native = false;
+    else if (arg == "--startup")
+      startup = true;
+    else if (arg == "--pipeline")
+      pipelined = true;
+    else
+      models.push_back(arg);
+  }
+  if (models.empty()) {
+    std::cerr << "Usage: " << argv[0] << " [-n <instances>] [--block <samples>]"
+              << " [--seconds <s>] [--intra-op <n>] [--inter-op <n>]"
+              << " [--torch] [--pipeline] <model>...\n"
+              << "       " << argv[0] << " --startup [--torch] <model>..."
+              << std::endl;
+    return 1;
+  }
+  if (startup) {
+    startup_report(models, prefer_native, options);
+    return 0;
+  }
+
+  if (pipelined) block_size = 64;
+  const int n_frames = block_size / 64;  // Models run once per 64 samples
+  const double period_us = 1e6 * n_frames * 64 / 44100.0;
+
+  std::vector<InstanceStats> stats(n_instances);
+  std::vector<std::thread> threads;
+  std::atomic<bool> start{false}, stop{false};
+  for (int i = 0; i < n_instances; i++)
+    threads.emplace_back(run_instance, std::cref(models[i % models.size()]),
+                         prefer_native, std::cref(options), n_frames,
+                         period_us, pipelined, std::ref(start), std::ref(stop),
+                         std::ref(stats[i]));
+  // Loading is not measured, give every instance time to finish it.
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  start = true;
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &thread : threads) thread.join();
+
+  std::vector<double> all;
+  int overruns = 0, misses = 0;
+  for (int i = 0; i < n_instances; i++) {
+    report(stats[i], i, period_us, pipelined);
+    all.insert(all.end(), stats[i].block_us.begin(), stats[i].block_us.end());
+    overruns += stats[i].overruns;
+    misses += stats[i].misses;
+  }
+  std::cout << "[BENCHMARK] " << n_instances << " instances, " << n_frames
+            << " frames per block: p50 " << percentile(all, 0.5)
+            << " us, p99 " << percentile(all, 0.99) << " us, " << overruns
+            << " of " << all.size() << " blocks over " << period_us << " us"
+            << (pipelined ? ", not ready: " + std::to_string(misses) : "")
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+
+
+/*
+File: ModelConverter.cpp
+Offline converter from TorchScript (.ts) models to flat .btm models.
+
+Usage:
+    BesselsTrickConverter [-o <output dir>] <model.ts>...
+    BesselsTrickConverter --verify <model.btm>...
+    BesselsTrickConverter --bank <output dir> <model>...
+
+--bank writes the models as C++ sources for the built-in bank (see
+BuiltinBank.hpp): builtin_model_<i>.cpp for the i-th model, and
+builtin_bank.cpp with the table of all of them. Models are named after their
+file, without the extension.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/Inference/BuiltinBank.hpp"
+#include "../src/Inference/FlatModel.hpp"
+#include "../src/Inference/NativeInference.hpp"
+#include "../src/Inference/TorchScriptArchive.hpp"
+
+static std::string base_name(const std::string &path) {
+  const std::string file = path.substr(path.find_last_of("/\\") + 1);
+  return file.substr(0, file.find_last_of('.'));
+}
+
+static bool convert(const std::string &input, const std::string &output_dir) {
+  constexpr int n_outputs = 6;
+  NativeGRUWeights weights;
+  if (!load_native_weights(input, n_outputs, weights)) {
+    std::cerr << "[CONVERTER] Unsupported model: " << input << std::endl;
+    return false;
+  }
+  TorchScriptArchive archive;
+  std::array<uint8_t, 156> patch;
+  const bool has_patch = archive.open(input) && archive.get_patch(patch);
+
+  const std::string output =
+      output_dir + "/" + base_name(input) + FLAT_MODEL_EXTENSION;
+  if (!write_flat_model(output, weights, n_outputs,
+                        has_patch ? &patch : nullptr))
+    return false;
+
+  FlatModelFile written;
+  if (!written.open(output) || !written.verify()) {
+    std::cerr << "[CONVERTER] Verification failed: " << output << std::endl;
+    return false;
+  }
+  std::cout << "[CONVERTER] " << input << " -> " << output << " (hidden "
+            << weights.hidden << ", hash " << std::hex
+            << written.header()->content_hash << std::dec << ")" << std::endl;
+  return true;
+}
+
+static bool verify(const std::string &input) {
+  FlatModelFile file;
+  if (!file.open(input)) return false;
+  const FlatModelHeader *h = file.header();
+  const bool valid = file.verify();
+  std::cout << input << ": version " << h->version << ", " << h->file_size
+            << " bytes, MLP " << h->n_pre << "+" << h->n_post << " layers, GRU "
+            << h->gru_input << " -> " << h->hidden << ", patch "
+            << (h->has_patch ? "yes" : "no") << ", hash " << std::hex
+            << h->content_hash << std::dec << (valid ? " OK" : " MISMATCH")
+            << std::endl;
+  return valid;
+}
+
+// Reads the float weights and patch of a .ts or .btm model.
+static bool read_model(const std::string &input, int n_outputs,
+                       NativeGRUWeights &weights,
+                       std::array<uint8_t, 156> &patch, bool &has_patch) {
+  if (is_flat_model_file(input))
+    return load_flat_weights(input, weights, patch, has_patch);
+  if (!load_native_weights(input, n_outputs, weights)) return false;
+  TorchScriptArchive archive;
+  has_patch = archive.open(input) && archive.get_patch(patch);
+  return true;
+}
+
+static bool write_bank(const std::vector<std::string> &inputs,
+                       const std::string &output_dir) {
+  constexpr int n_outputs = 6;
+  std::vector<std::string> symbols;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    NativeGRUWeights weights;
+    std::array<uint8_t, 156> patch;
+    bool has_patch = false;
+    if (!read_model(inputs[i], n_outputs, weights, patch, has_patch) ||
+        !validate_native_weights(weights, n_outputs)) {
+      std::cerr << "[CONVERTER] Unsupported model: " << inputs[i] << std::endl;
+      return false;
+    }
+    const std::string symbol = "builtin_model_" + std::to_string(i);
+    const std::string output = output_dir + "/" + symbol + ".cpp";
+    if (!write_builtin_model(output, symbol, base_name(inputs[i]), weights,
+                             has_patch ? &patch : nullptr))
+      return false;
+    std::cout << "[CONVERTER] " << inputs[i] << " -> " << output << std::endl;
+    symbols.push_back(symbol);
+  }
+  return write_builtin_bank(output_dir + "/builtin_bank.cpp", symbols);
+}
+
+int main(int argc, char **argv) {
+  std::string output_dir = ".";
+  bool verify_mode = false;
+  bool bank_mode = false;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc)
+      output_dir = argv[++i];
+    else if (arg == "--verify")
+      verify_mode = true;
+    else if (arg == "--bank" && i + 1 < argc) {
+      bank_mode = true;
+      output_dir = argv[++i];
+    }
+    else
+      inputs.push_back(arg);
+  }
+  if (inputs.empty()) {
+    std::cerr << "Usage: " << argv[0] << " [-o <output dir>] <model.ts>...\n"
+              << "       " << argv[0] << " --verify <model.btm>...\n"
+              << "       " << argv[0] << " --bank <output dir> <model>..."
+              << std::endl;
+    return 1;
+  }
+  if (bank_mode) return write_bank(inputs, output_dir) ? 0 : 1;
+
+  int failures = 0;
+  for (const auto &input : inputs)
+    if (!(verify_mode ? verify(input) : convert(input, output_dir))) failures++;
+  return failures == 0 ? 0 : 1;
+}
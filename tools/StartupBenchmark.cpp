@@ -0,0 +1,118 @@
+/*
+ ==============================================================================
+    Copyright (c) 2023 Franco Caspe
+    All rights reserved.
+
+    **BSD 3-Clause License**
+
+    Redistribution and use in source and binary forms, with or without modification,
+    are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+ ==============================================================================
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+    INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+    OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+    OF THE POSSIBILITY OF SUCH DAMAGE.
+ ==============================================================================
+*/
+/*
+File: StartupBenchmark.cpp
+Times the construction of the plugin processor, the way a host creates it
+while scanning: cold, the first instance of the process, and warm.
+
+Usage:
+    BesselsTrickStartupBenchmark [-n <instances>] [--keep]
+
+Creates n instances (default 20) one after the other and reports the cold
+construction time, then the median and worst warm one, and the median
+destruction time. With --keep every instance stays alive until the end, as
+in a session with many tracks; by default each one is destroyed before the
+next is created, as in a plugin scan.
+
+Build it from a checkout of an earlier revision to compare: construction
+used to start the model loader thread, size the libtorch pools and open
+the OSC socket, which now wait for the first model and prepareToPlay.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/PluginProcessor.hpp"
+
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter();
+
+static double median(std::vector<double> values) {
+  if (values.empty()) return 0.0;
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[]) {
+  int n_instances = 20;
+  bool keep = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc)
+      n_instances = std::max(2, std::stoi(argv[++i]));
+    else if (arg == "--keep")
+      keep = true;
+    else {
+      std::cerr << "Usage: " << argv[0] << " [-n <instances>] [--keep]"
+                << std::endl;
+      return 1;
+    }
+  }
+  // Hosts create plugins on the message thread.
+  juce::ScopedJuceInitialiser_GUI juce_init;
+
+  using clock = std::chrono::steady_clock;
+  auto elapsed_us = [](clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(clock::now() - start)
+        .count();
+  };
+  std::vector<std::unique_ptr<juce::AudioProcessor>> instances;
+  std::vector<double> construct_us, destruct_us;
+  for (int i = 0; i < n_instances; i++) {
+    auto start = clock::now();
+    instances.emplace_back(createPluginFilter());
+    construct_us.push_back(elapsed_us(start));
+    if (keep) continue;
+    start = clock::now();
+    instances.clear();
+    destruct_us.push_back(elapsed_us(start));
+  }
+  while (!instances.empty()) {
+    const auto start = clock::now();
+    instances.pop_back();
+    destruct_us.push_back(elapsed_us(start));
+  }
+
+  const std::vector<double> warm(construct_us.begin() + 1,
+                                 construct_us.end());
+  std::cout << "[BENCHMARK] " << n_instances << " instances"
+            << (keep ? " kept alive" : "") << ": constructed in "
+            << construct_us[0] << " us (cold), " << median(warm)
+            << " us median, " << *std::max_element(warm.begin(), warm.end())
+            << " us worst (warm); destroyed in " << median(destruct_us)
+            << " us median" << std::endl;
+  return 0;
+}